@@ -0,0 +1,128 @@
+// Latency benchmark of ht_set with and without incremental resize
+//
+// bench_hash [-n keys] [-o results.csv]
+//
+// Inserts n distinct keys into an empty table, timing each ht_set, once
+// with the whole table rehashed when it grows and once in incremental
+// mode. Percentiles and the maximum show the stalls of resizing.
+
+#include "kvphash_table.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int compare_latency(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Returns latency at fraction q of sorted latencies */
+static uint64_t percentile(const uint64_t* sorted, size_t n, double q)
+{
+    size_t i = (size_t)(q * (double)(n - 1));
+    return sorted[i];
+}
+
+static int run(bool incremental, size_t n, uint64_t* latency, FILE* results)
+{
+    static int value = 1;
+    kvphash_table* table = ht_create();
+    if(table == NULL) {
+        printf("hash table was not created\n");
+        return EXIT_BAD_HASH_TABLE;
+    }
+    ht_set_incremental(table, incremental);
+
+    char key[32];
+    uint64_t total = 0;
+    for(size_t i = 0; i < n; i++) {
+        // keys spread over the table as ids of a dictionary would
+        snprintf(key, sizeof(key), "key_%016llx", (unsigned long long)(i * 0x9E3779B97F4A7C15ULL));
+        uint64_t start = now_ns();
+        const char* stored = ht_set(table, key, &value);
+        latency[i] = now_ns() - start;
+        total += latency[i];
+        if(stored == NULL) {
+            printf("hash set did not work\n");
+            ht_destroy(table);
+            return EXIT_BAD_MALLOC;
+        }
+    }
+    ht_destroy(table);
+
+    qsort(latency, n, sizeof(*latency), compare_latency);
+    const char* mode = incremental ? "incremental" : "rehash";
+    printf("%-12s %10zu %10.1f %8.1f %8llu %8llu %8llu %8llu %10llu\n", mode, n, total / 1e6, (double)total / n,
+           (unsigned long long)percentile(latency, n, 0.5), (unsigned long long)percentile(latency, n, 0.99),
+           (unsigned long long)percentile(latency, n, 0.999), (unsigned long long)percentile(latency, n, 0.9999),
+           (unsigned long long)latency[n - 1]);
+    if(results != NULL) {
+        fprintf(results, "%s,%zu,%.3f,%.1f,%llu,%llu,%llu,%llu,%llu\n", mode, n, total / 1e6, (double)total / n,
+                (unsigned long long)percentile(latency, n, 0.5), (unsigned long long)percentile(latency, n, 0.99),
+                (unsigned long long)percentile(latency, n, 0.999), (unsigned long long)percentile(latency, n, 0.9999),
+                (unsigned long long)latency[n - 1]);
+    }
+    return EXIT_NO_ERRORS;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t n = 4000000;
+    const char* results_path = NULL;
+
+    for(int i = 1; i < argc; i++) {
+        if(i + 1 < argc && strcmp(argv[i], "-n") == 0) {
+            n = strtoul(argv[++i], NULL, 10);
+        } else if(i + 1 < argc && strcmp(argv[i], "-o") == 0) {
+            results_path = argv[++i];
+        } else {
+            n = 0;
+            break;
+        }
+    }
+    if(n == 0) {
+        printf("USAGE: %s [-n keys] [-o results.csv]\n", argv[0]);
+        printf("where -n - number of keys inserted (default 4000000);\n");
+        printf("-o - csv file to append results to.\n");
+        return EXIT_WRONG_ARG_COUNT;
+    }
+
+    uint64_t* latency = malloc(n * sizeof(*latency));
+    if(latency == NULL) {
+        return EXIT_BAD_MALLOC;
+    }
+    FILE* results = NULL;
+    if(results_path != NULL) {
+        results = fopen(results_path, "a");
+        if(results == NULL) {
+            printf("ERROR: cannot open file %s for writing\n", results_path);
+            free(latency);
+            return EXIT_BAD_FILE_NAME;
+        }
+        if(ftell(results) == 0)
+            fprintf(results, "mode,keys,total_ms,mean_ns,p50_ns,p99_ns,p999_ns,p9999_ns,max_ns\n");
+    }
+
+    printf("%-12s %10s %10s %8s %8s %8s %8s %8s %10s\n", "mode", "keys", "total ms", "mean ns", "p50", "p99",
+           "p99.9", "p99.99", "max ns");
+    int status = run(false, n, latency, results);
+    if(status == EXIT_NO_ERRORS)
+        status = run(true, n, latency, results);
+
+    if(results != NULL)
+        fclose(results);
+    free(latency);
+    return status;
+}
@@ -0,0 +1,372 @@
+// Parser throughput benchmark on generated corpora
+//
+// bench_kvp [-s size] [-r repetitions] [-p corpus] [-d dir] [-o results.csv] [-k]
+//
+// Each corpus is generated deterministically (same size and corpus give the
+// same bytes on every run), written to dir and read through the stream,
+// buffer and mmap sources. Best and mean time of the repetitions are printed
+// as MB/s, pairs/s and ns/pair, and appended as csv lines to results file.
+
+#include "kvp_parser.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+enum bench_strings { STRINGS_ASCII, STRINGS_UTF8, STRINGS_ESCAPED };
+enum bench_numbers { NUMBERS_INT, NUMBERS_FLOAT };
+enum bench_sources { SOURCE_STREAM, SOURCE_BUFFER, SOURCE_MMAP, SOURCE_COUNT };
+
+static const char* source_names[SOURCE_COUNT] = {"stream", "buffer", "mmap"};
+
+typedef struct bench_corpus {
+    const char* name;
+    size_t key_min; /// key length range
+    size_t key_max;
+    enum bench_strings strings;
+    enum bench_numbers numbers;
+    size_t pairs_min; /// pairs per object range
+    size_t pairs_max;
+} bench_corpus;
+
+// baseline first, then one dimension changed at a time
+static const bench_corpus corpora[] = {
+    {"base", 1, 6, STRINGS_ASCII, NUMBERS_INT, 2, 6},
+    {"long-keys", 24, 48, STRINGS_ASCII, NUMBERS_INT, 2, 6},
+    {"utf8", 1, 6, STRINGS_UTF8, NUMBERS_INT, 2, 6},
+    {"escaped", 1, 6, STRINGS_ESCAPED, NUMBERS_INT, 2, 6},
+    {"float", 1, 6, STRINGS_ASCII, NUMBERS_FLOAT, 2, 6},
+    {"wide", 1, 6, STRINGS_ASCII, NUMBERS_INT, 48, 96},
+};
+
+#define CORPUS_COUNT (sizeof(corpora) / sizeof(*corpora))
+#define SHAPES 8 /// distinct key sequences of objects
+
+/* xorshift64*, fixed seed keeps corpora reproducible */
+static uint64_t rnd_state;
+
+static uint64_t rnd(void)
+{
+    rnd_state ^= rnd_state >> 12;
+    rnd_state ^= rnd_state << 25;
+    rnd_state ^= rnd_state >> 27;
+    return rnd_state * 0x2545F4914F6CDD1DULL;
+}
+
+static size_t rnd_range(size_t min, size_t max)
+{
+    return min + (size_t)(rnd() % (max - min + 1));
+}
+
+static void write_key(FILE* out, const bench_corpus* corpus, size_t shape, size_t index)
+{
+    // key text depends only on its shape and index, so keys repeat
+    uint64_t h = (shape * 131 + index + 1) * 0x9E3779B97F4A7C15ULL;
+    size_t length = corpus->key_min + (size_t)(h >> 40) % (corpus->key_max - corpus->key_min + 1);
+    fputc('"', out);
+    for(size_t i = 0; i < length; i++) {
+        fputc('a' + (int)(((h >> (i % 8 * 8)) + i) % 26), out);
+    }
+    fputc('"', out);
+}
+
+static void write_string(FILE* out, const bench_corpus* corpus)
+{
+    static const char* utf8[] = {"\xd0\x96", "\xd0\xb9", "\xe4\xb8\xad", "\xe6\x96\x87", "\xf0\x9f\x98\x80"};
+    static const char* escapes[] = {"\\n", "\\t", "\\\"", "\\\\", "\\u0416", "\\u4e2d", "\\ud83d\\ude00"};
+    size_t length = rnd_range(4, 40);
+
+    fputc('"', out);
+    for(size_t i = 0; i < length; i++) {
+        uint64_t r = rnd();
+        int c = '!' + (int)(r % 94);
+        switch(corpus->strings) {
+        case STRINGS_ASCII:
+            fputc(c == '"' || c == '\\' ? 'x' : c, out);
+            break;
+        case STRINGS_UTF8:
+            if(r % 2)
+                fputs(utf8[(r >> 8) % 5], out);
+            else
+                fputc('a' + (int)((r >> 8) % 26), out);
+            break;
+        case STRINGS_ESCAPED:
+            if(r % 3 == 0)
+                fputs(escapes[(r >> 8) % 7], out);
+            else
+                fputc('a' + (int)((r >> 8) % 26), out);
+            break;
+        }
+    }
+    fputc('"', out);
+}
+
+static void write_value(FILE* out, const bench_corpus* corpus)
+{
+    uint64_t r = rnd();
+    switch(r % 10) {
+    case 0:
+        fputs(r & 0x100 ? "true" : "false", out);
+        break;
+    case 1:
+        fputs("null", out);
+        break;
+    case 2:
+    case 3:
+    case 4:
+    case 5:
+        if(corpus->numbers == NUMBERS_INT)
+            fprintf(out, "%lld", (long long)(int32_t)(r >> 16) >> (r >> 8) % 24);
+        else
+            fprintf(out, "%.*g", 1 + (int)(r >> 8) % 16, (double)(int32_t)(r >> 16) / (1 + (r >> 48)));
+        break;
+    default:
+        write_string(out, corpus);
+        break;
+    }
+}
+
+/* Writes at least size bytes of objects to path, returns pairs written or 0 */
+static size_t generate(const char* path, const bench_corpus* corpus, size_t size)
+{
+    FILE* out = fopen(path, "wb");
+    if(out == NULL) {
+        printf("ERROR: cannot open file %s for writing: %s\n", path, strerror(errno));
+        return 0;
+    }
+    setvbuf(out, NULL, _IOFBF, 1 << 20);
+    rnd_state = 0x853C49E6748FEA9BULL;
+
+    size_t pairs = 0;
+    while((size_t)ftell(out) < size) {
+        size_t shape = rnd() % SHAPES;
+        // each shape has its own fixed width
+        uint64_t saved = rnd_state;
+        rnd_state = 0x9E3779B97F4A7C15ULL * (shape + 1);
+        size_t width = rnd_range(corpus->pairs_min, corpus->pairs_max);
+        rnd_state = saved;
+
+        fputc('{', out);
+        for(size_t i = 0; i < width; i++) {
+            if(i > 0)
+                fputs(", ", out);
+            write_key(out, corpus, shape, i);
+            fputs(": ", out);
+            write_value(out, corpus);
+        }
+        fputs("}\n", out);
+        pairs += width;
+    }
+    if(fclose(out) != 0) {
+        printf("ERROR: cannot write file %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    return pairs;
+}
+
+static char* read_file(const char* path, size_t* size)
+{
+    FILE* in = fopen(path, "rb");
+    if(in == NULL)
+        return NULL;
+    fseek(in, 0, SEEK_END);
+    *size = (size_t)ftell(in);
+    fseek(in, 0, SEEK_SET);
+    char* data = malloc(*size + 1);
+    if(data != NULL && fread(data, 1, *size, in) != *size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(in);
+    return data;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Parses the corpus once through source, returns pairs read or -1 */
+static long long parse(enum bench_sources source, const char* path, const char* data, size_t size)
+{
+    kvp_iterator json;
+    FILE* file = NULL;
+
+    switch(source) {
+    case SOURCE_STREAM:
+        file = fopen(path, "rb");
+        if(file == NULL)
+            return -1;
+        kvp_open_stream(&json, file);
+        break;
+    case SOURCE_BUFFER:
+        kvp_open_buffer(&json, data, size);
+        break;
+    case SOURCE_MMAP:
+        if(kvp_open_mmap(&json, path) != 0)
+            return -1;
+        break;
+    default:
+        return -1;
+    }
+
+    long long pairs = 0;
+    kvp_pair pair;
+    enum kvp_json_type type;
+    while((type = kvp_next_pair(&json, &pair)) != JSON_END) {
+        if(type == JSON_ERROR) {
+            printf("ERROR: %s: %zu: %s\n", path, kvp_get_lineno(&json), kvp_get_error(&json));
+            pairs = -1;
+            break;
+        }
+        pairs++;
+    }
+    kvp_close(&json);
+    if(file != NULL)
+        fclose(file);
+    return pairs;
+}
+
+static size_t parse_size(const char* text)
+{
+    char* end;
+    double value = strtod(text, &end);
+    switch(*end) {
+    case 'k':
+    case 'K':
+        value *= 1 << 10;
+        break;
+    case 'm':
+    case 'M':
+        value *= 1 << 20;
+        break;
+    case 'g':
+    case 'G':
+        value *= 1 << 30;
+        break;
+    case '\0':
+        break;
+    default:
+        return 0;
+    }
+    return value < 1 ? 0 : (size_t)value;
+}
+
+static void usage(const char* name)
+{
+    printf("USAGE: %s [-s size] [-r repetitions] [-p corpus] [-d dir] [-o results.csv] [-k]\n", name);
+    printf("where -s - corpus size with K, M or G suffix (1M..4G, default 16M);\n");
+    printf("-r - parses of each corpus by each source (default 5);\n");
+    printf("-p - corpus to run (default all):");
+    for(size_t i = 0; i < CORPUS_COUNT; i++)
+        printf(" %s", corpora[i].name);
+    printf(";\n");
+    printf("-d - directory for corpus files (default /tmp);\n");
+    printf("-o - csv file to append results to;\n");
+    printf("-k - keep corpus files.\n");
+}
+
+int main(int argc, char* argv[])
+{
+    size_t size = 16 << 20;
+    int repetitions = 5;
+    const char* only = NULL;
+    const char* dir = "/tmp";
+    const char* results_path = NULL;
+    bool keep = false;
+
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "-k") == 0) {
+            keep = true;
+        } else if(i + 1 < argc && strcmp(argv[i], "-s") == 0) {
+            size = parse_size(argv[++i]);
+        } else if(i + 1 < argc && strcmp(argv[i], "-r") == 0) {
+            repetitions = atoi(argv[++i]);
+        } else if(i + 1 < argc && strcmp(argv[i], "-p") == 0) {
+            only = argv[++i];
+        } else if(i + 1 < argc && strcmp(argv[i], "-d") == 0) {
+            dir = argv[++i];
+        } else if(i + 1 < argc && strcmp(argv[i], "-o") == 0) {
+            results_path = argv[++i];
+        } else {
+            usage(argv[0]);
+            return EXIT_WRONG_ARG_COUNT;
+        }
+    }
+    if(size == 0 || repetitions < 1) {
+        usage(argv[0]);
+        return EXIT_WRONG_ARG_COUNT;
+    }
+
+    FILE* results = NULL;
+    if(results_path != NULL) {
+        results = fopen(results_path, "a");
+        if(results == NULL) {
+            printf("ERROR: cannot open file %s for writing\n", results_path);
+            return EXIT_BAD_FILE_NAME;
+        }
+        if(ftell(results) == 0)
+            fprintf(results, "corpus,source,bytes,pairs,repetitions,best_s,mean_s,mb_s,pairs_s,ns_pair\n");
+    }
+
+    printf("%-10s %-7s %12s %12s %10s %12s %9s\n", "corpus", "source", "bytes", "pairs", "MB/s", "pairs/s", "ns/pair");
+    int status = EXIT_NO_ERRORS;
+    for(size_t c = 0; c < CORPUS_COUNT && status == EXIT_NO_ERRORS; c++) {
+        const bench_corpus* corpus = &corpora[c];
+        if(only != NULL && strcmp(only, corpus->name) != 0)
+            continue;
+
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/bench_kvp_%s.json", dir, corpus->name);
+        size_t pairs = generate(path, corpus, size);
+        size_t bytes = 0;
+        char* data = pairs > 0 ? read_file(path, &bytes) : NULL;
+        if(data == NULL) {
+            status = pairs > 0 ? EXIT_BAD_MALLOC : EXIT_BAD_FILE_NAME;
+            break;
+        }
+
+        for(int s = 0; s < SOURCE_COUNT; s++) {
+            double best = 0;
+            double total = 0;
+            for(int r = 0; r < repetitions; r++) {
+                double start = now();
+                long long read = parse(s, path, data, bytes);
+                double elapsed = now() - start;
+                if(read != (long long)pairs) {
+                    printf("ERROR: %s by %s: %lld pairs read of %zu\n", corpus->name, source_names[s], read, pairs);
+                    status = EXIT_JSON_ERROR;
+                    break;
+                }
+                if(r == 0 || elapsed < best)
+                    best = elapsed;
+                total += elapsed;
+            }
+            if(status != EXIT_NO_ERRORS)
+                break;
+
+            double mb_s = bytes / best / (1 << 20);
+            double pairs_s = pairs / best;
+            double ns_pair = best * 1e9 / pairs;
+            printf("%-10s %-7s %12zu %12zu %10.1f %12.0f %9.2f\n", corpus->name, source_names[s], bytes, pairs,
+                   mb_s, pairs_s, ns_pair);
+            if(results != NULL) {
+                fprintf(results, "%s,%s,%zu,%zu,%d,%.6f,%.6f,%.2f,%.0f,%.3f\n", corpus->name, source_names[s], bytes,
+                        pairs, repetitions, best, total / repetitions, mb_s, pairs_s, ns_pair);
+            }
+        }
+
+        free(data);
+        if(!keep)
+            remove(path);
+    }
+
+    if(results != NULL)
+        fclose(results);
+    return status;
+}
@@ -8,21 +8,110 @@
 #include "kvphash_table.h"
 #include "tlv_work.h"
 
+/* Sets code of the key with id (ids are 1,2,3... as keys are interned),
+ * growing the codes array */
+static bool set_key_code(int** codes, size_t* size, size_t id, int code)
+{
+    if(id > *size) {
+        size_t n = id > 2 * *size ? id : 2 * *size;
+        int* p = realloc(*codes, n * sizeof(int));
+        if(p == NULL)
+            return false;
+        *codes = p;
+        *size = n;
+    }
+    (*codes)[id - 1] = code;
+    return true;
+}
+
+/* Fills table with comma separated keys of the list */
+static bool read_key_list(kvphash_table* table, char* list)
+{
+    for(char* key = strtok(list, ","); key != NULL; key = strtok(NULL, ",")) {
+        if(ht_set_int(table, key, strlen(key), 1) == NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Prints counters of the parser */
+static void print_parser_stats(kvp_iterator* json)
+{
+    kvp_stats stats;
+    if(!kvp_get_stats(json, &stats)) {
+        printf("stats: parser is built without KVP_STATS\n");
+        return;
+    }
+    size_t hits, misses;
+    kvp_get_shape_stats(json, &hits, &misses);
+
+    printf("stats:\n");
+    printf("  bytes            %zu\n", stats.bytes);
+    printf("  keys             %zu\n", stats.keys);
+    printf("  strings          %zu\n", stats.tokens[JSON_STRING]);
+    printf("  numbers          %zu\n", stats.tokens[JSON_NUMBER]);
+    printf("  true             %zu\n", stats.tokens[JSON_TRUE]);
+    printf("  false            %zu\n", stats.tokens[JSON_FALSE]);
+    printf("  null             %zu\n", stats.tokens[JSON_NULL]);
+    printf("  escapes          %zu\n", stats.escapes);
+    printf("  utf8 sequences   %zu\n", stats.utf8);
+    printf("  string reallocs  %zu\n", stats.reallocs);
+    printf("  peak string size %zu\n", stats.peak_string_size);
+    printf("  shape hits       %zu\n", hits);
+    printf("  shape misses     %zu\n", misses);
+}
+
 int main(int argc, char* argv[])
 {
     kvp_iterator json;
     kvp_iterator dict;
     bool dict_from_file = false;
 
+    // keys are interned into dict_keys by the iterators, code of the key
+    // with id is key_codes[id - 1]
     kvphash_table* dict_keys = ht_create();
     if(dict_keys == NULL) {
         return EXIT_BAD_HASH_TABLE;
     }
+    // conversion of many keys does not stall when the table grows
+    ht_set_incremental(dict_keys, true);
+    int* key_codes = NULL;
+    size_t key_codes_size = 0;
+    size_t known_keys = 0;
+
+    // --keys a,b,c reads only listed keys, --stats prints parser counters
+    kvphash_table* filter_keys = NULL;
+    bool print_stats = false;
+    while(argc > 1) {
+        if(argc > 2 && strcmp(argv[1], "--keys") == 0 && filter_keys == NULL) {
+            filter_keys = ht_create();
+            if(filter_keys == NULL) {
+                return EXIT_BAD_HASH_TABLE;
+            }
+            if(!read_key_list(filter_keys, argv[2])) {
+                return EXIT_BAD_MALLOC;
+            }
+            argv[2] = argv[0];
+            argv += 2;
+            argc -= 2;
+        } else if(strcmp(argv[1], "--stats") == 0) {
+            print_stats = true;
+            argv[1] = argv[0];
+            argv++;
+            argc--;
+        } else {
+            break;
+        }
+    }
 
     if(argc < 2 || argc > 4) {
 
-        printf("USAGE: %s output_TLV_file [KVP_input_file] [dict_json_file]\n", argv[0]);
-        printf("where output_TLV_file  - tlv file for output;\n");
+        printf("USAGE: %s [--keys key1,key2,...] [--stats] output_TLV_file [KVP_input_file] [dict_json_file]\n",
+               argv[0]);
+        printf("where --keys - write only pairs of listed keys, others are skipped;\n");
+        printf("--stats - print counters of the parser (if it is built with KVP_STATS);\n");
+        printf("output_TLV_file  - tlv file for output;\n");
         printf("KVP_input_file - input file with KV pairs in JSON style\n");
         printf(" if it is not present - we must input KV in console;\n");
         printf("dict_json_file - input file with Keys values pairs in th same JSON style\n");
@@ -31,17 +120,19 @@ int main(int argc, char* argv[])
 
     } else if(argc == 2) {
         // if argc==2 we input KVP from console
-        kvp_open_stream(&json, stdin);
+        kvp_open_fd(&json, fileno(stdin), 0);
 
     } else {
-        // input from file
-        FILE* file_json_kvp = fopen(argv[2], "rb");
+        // input from file: map it, or read by blocks if it cannot be mapped
+        if(kvp_open_mmap(&json, argv[2]) != 0) {
+            FILE* file_json_kvp = fopen(argv[2], "rb");
 
-        if(!file_json_kvp) {
-            printf("ERROR: cannot open file %s for read\n", argv[2]);
-            return EXIT_BAD_FILE_NAME;
+            if(!file_json_kvp) {
+                printf("ERROR: cannot open file %s for read\n", argv[2]);
+                return EXIT_BAD_FILE_NAME;
+            }
+            kvp_open_fd(&json, fileno(file_json_kvp), 0);
         }
-        kvp_open_stream(&json, file_json_kvp);
 
         // if we predefine the dictionary of keys
         if(argc == 4) {
@@ -53,47 +144,25 @@ int main(int argc, char* argv[])
                 printf("ERROR: cannot open file %s for read\n", argv[3]);
                 return EXIT_BAD_FILE_NAME;
             }
-            kvp_open_stream(&dict, file_json_dict);
+            kvp_open_fd(&dict, fileno(file_json_dict), 0);
+            kvp_set_key_interning(&dict, dict_keys);
 
             // dictionary should be as single json dict
             enum kvp_json_type result = 0;
-            size_t len;
+            kvp_pair pair;
 
-            while(dict.type != JSON_ERROR) {
-                result = kvp_next(&dict);
+            while((result = kvp_next_pair(&dict, &pair)) != JSON_END) {
                 if(result == JSON_ERROR) {
                     return EXIT_JSON_ERROR;
                 }
-                if(result == JSON_END) {
-                    break;
-                }
-
-                void* value = ht_get(dict_keys, kvp_get_string(&dict, &len));
-                if(value != NULL) {
-                    printf("We alredy had this value %s", kvp_get_string(&dict, &len));
+                if(pair.key_id <= known_keys) {
+                    printf("We alredy had this value %.*s", (int)pair.key_length, pair.key);
                     continue;
                 }
-                // allocate space for new int and set it to count
-                int* val = malloc(sizeof(int));
-                if(val == NULL) {
+                if(!set_key_code(&key_codes, &key_codes_size, pair.key_id, kvp_get_int(&dict))) {
                     return EXIT_BAD_MALLOC;
                 }
-                char* buf = malloc(len + 1);
-                size_t n = kvp_save_string(&dict, buf);
-
-                result = kvp_next(&dict);
-                if(result == JSON_ERROR) {
-                    return EXIT_JSON_ERROR;
-                }
-                if(result == JSON_END) {
-                    break;
-                }
-
-                *val = kvp_get_int(&dict);
-                if(ht_set(dict_keys, buf, val) == NULL) {
-                    return EXIT_BAD_MALLOC;
-                }
-                free(buf);
+                known_keys = pair.key_id;
             }
 
             kvp_close(&dict);
@@ -106,6 +175,8 @@ int main(int argc, char* argv[])
     int count_keys = 0;
 
     kvp_set_streaming(&json, false);
+    kvp_set_key_filter(&json, filter_keys);
+    kvp_set_key_interning(&json, dict_keys);
 
     // open file for writing
     FILE* tlv_to_write = fopen(argv[1], "wb");
@@ -115,74 +186,41 @@ int main(int argc, char* argv[])
     }
 
     enum kvp_json_type result = 0;
+    kvp_pair pair;
 
     printf("read the KV pairs and write them:\n");
-    while(json.type != JSON_ERROR) {
-
-        result = kvp_next(&json);
+    while((result = kvp_next_pair(&json, &pair)) != JSON_END) {
 
         if(result == JSON_ERROR) {
-            return EXIT_JSON_ERROR;
-        }
-        if(result == JSON_END) {
             break;
         }
-
-        size_t len = 0;
-        //printf("\nkey=%s ", kvp_get_string(&json, &len));
-
-        void* value = ht_get(dict_keys, kvp_get_string(&json, &len));
-        if(value == NULL) {
-            // no key in hashtable, increment counter
+        if(pair.key_id > known_keys) {
+            // new key, increment counter
             count_keys++;
-
-            // allocate space for new int and set it to count
-            int* pcount = malloc(sizeof(int));
-            if(pcount == NULL) {
+            if(!set_key_code(&key_codes, &key_codes_size, pair.key_id, count_keys)) {
                 return EXIT_BAD_MALLOC;
             }
-            *pcount = count_keys;
-            if(ht_set(dict_keys, kvp_get_string(&json, &len), pcount) == NULL) {
-                return EXIT_BAD_MALLOC;
-            }
-            // free(pcount);
+            known_keys = pair.key_id;
         }
 
         // output data into TLV file
-        //   write_data(argv[1], ht_get(dict_keys, json->data));
-
-        tlv_write_file(NUMBER_TLV, 1, ht_get(dict_keys, kvp_get_string(&json, &len)), tlv_to_write);
-
-        result = kvp_next(&json);
-        if(result == JSON_ERROR) {
-            return EXIT_JSON_ERROR;
-        }
-        if(result == JSON_END) {
-            break;
-        }
-
-        char* buf = malloc(json.data.string_size);
-        kvp_get_value(&json, buf, &len);
-        //printf("value=%s", buf);
+        tlv_write_file(NUMBER_TLV, 1, &key_codes[pair.key_id - 1], tlv_to_write);
 
         bool x;
         int y;
-         // output data into TLV file
-        switch(json.type) {
+        // output data into TLV file, value text is taken in place
+        switch(pair.type) {
         case JSON_STRING:
-            tlv_write_file(STRING_TLV, json.data.string_size, json.data.string, tlv_to_write);
+            tlv_write_file(STRING_TLV, pair.value_length, (void*)pair.value, tlv_to_write);
             break;
 
         case JSON_NUMBER: // TODO: int union
-            tlv_write_file(NUMBER_TLV, 1, json.data.string, tlv_to_write);
+            tlv_write_file(NUMBER_TLV, 1, (void*)pair.value, tlv_to_write);
             break;
 
         case JSON_TRUE:
-            x = true;
-            tlv_write_file(BOOL_TLV, 1, &x, tlv_to_write);
-            break;
         case JSON_FALSE:
-            x = false;
+            x = pair.scalar.boolean;
             tlv_write_file(BOOL_TLV, 1, &x, tlv_to_write);
             break;
 
@@ -191,20 +229,20 @@ int main(int argc, char* argv[])
             tlv_write_file(NUMBER_TLV, 1, &y, tlv_to_write);
             break;
         default:
-            printf("Unknown type %d", (int)(json.type));
+            printf("Unknown type %d", (int)(pair.type));
             return EXIT_JSON_ERROR;
         }
-        free(buf);
-
-
     }
 
     if(result == JSON_ERROR) {
-        fprintf(stderr, "error: %zu: %s\n", kvp_get_lineno(&json), kvp_get_error(&json));
+        fprintf(stderr, "error: %zu:%zu: %s\n", kvp_get_lineno(&json), kvp_get_column(&json), kvp_get_error(&json));
         return EXIT_JSON_ERROR;
     } else {
         printf("\n");
     }
+    if(print_stats) {
+        print_parser_stats(&json);
+    }
     kvp_close(&json);
 
     // Print out keys dict
@@ -215,11 +253,14 @@ int main(int argc, char* argv[])
         //printf("\n %s , %d", it.key, (int)*((int*)it.value));
 
         tlv_write_file(STRING_TLV, strlen(it.key), (void*)it.key, tlv_to_write);
-        tlv_write_file(NUMBER_TLV, 1, (int*)it.value, tlv_to_write);
-        free(it.value);
+        tlv_write_file(NUMBER_TLV, 1, &key_codes[(uintptr_t)it.value - 1], tlv_to_write);
     }
+    free(key_codes);
 
     ht_destroy(dict_keys);
+    if(filter_keys != NULL) {
+        ht_destroy(filter_keys);
+    }
 
     fclose(tlv_to_write);
 
@@ -0,0 +1,208 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2022, Viktor Borodin
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kvp_arena.h"
+
+struct kvp_arena_block {
+    struct kvp_arena_block *next;
+    size_t size; /// bytes of data
+    size_t fill; /// bytes allocated
+    max_align_t data[];
+};
+
+// every allocation is preceded by its size for realloc
+typedef union arena_header {
+    size_t size;
+    max_align_t align;
+} arena_header;
+
+#define ARENA_ALIGN (sizeof(max_align_t))
+
+static size_t align_size(size_t size)
+{
+    return (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+static struct kvp_arena_block* new_block(kvp_arena* arena, size_t size)
+{
+    struct kvp_arena_block* block = (struct kvp_arena_block*)malloc(sizeof(*block) + size);
+    if(block == NULL)
+        return NULL;
+    block->size = size;
+    block->fill = 0;
+    block->next = arena->blocks;
+    arena->blocks = block;
+    arena->blocks_size += size;
+    return block;
+}
+
+kvp_arena* kvp_arena_create(size_t block_size)
+{
+    kvp_arena* arena = (kvp_arena*)malloc(sizeof(*arena));
+    if(arena == NULL)
+        return NULL;
+    arena->blocks = NULL;
+    arena->block_size = align_size(block_size > 0 ? block_size : KVP_ARENA_BLOCK_SIZE);
+    arena->used = 0;
+    arena->high_water = 0;
+    arena->blocks_size = 0;
+    arena->last = NULL;
+    if(new_block(arena, arena->block_size) == NULL) {
+        free(arena);
+        return NULL;
+    }
+    return arena;
+}
+
+static void free_blocks(kvp_arena* arena)
+{
+    struct kvp_arena_block* block = arena->blocks;
+    while(block != NULL) {
+        struct kvp_arena_block* next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->blocks = NULL;
+    arena->blocks_size = 0;
+}
+
+void kvp_arena_reset(kvp_arena* arena)
+{
+    if(arena->blocks != NULL && arena->blocks->next != NULL) {
+        size_t size = align_size(arena->high_water);
+        if(size < arena->block_size)
+            size = arena->block_size;
+        free_blocks(arena);
+        new_block(arena, size); // on failure blocks are allocated again on demand
+    }
+    if(arena->blocks != NULL)
+        arena->blocks->fill = 0;
+    arena->used = 0;
+    arena->last = NULL;
+}
+
+void kvp_arena_destroy(kvp_arena* arena)
+{
+    if(arena == NULL)
+        return;
+    free_blocks(arena);
+    free(arena);
+}
+
+void* kvp_arena_alloc(kvp_arena* arena, size_t size)
+{
+    size_t need = sizeof(arena_header) + align_size(size);
+    struct kvp_arena_block* block = arena->blocks;
+    if(block == NULL || block->size - block->fill < need) {
+        size_t block_size = arena->block_size;
+        if(block_size < need)
+            block_size = align_size(need);
+        // the rest of the current block is not used any more
+        if((block = new_block(arena, block_size)) == NULL)
+            return NULL;
+    }
+    arena_header* header = (arena_header*)((char*)block->data + block->fill);
+    header->size = size;
+    block->fill += need;
+    arena->used += need;
+    if(arena->used > arena->high_water)
+        arena->high_water = arena->used;
+    arena->last = header + 1;
+    return arena->last;
+}
+
+void* kvp_arena_realloc(kvp_arena* arena, void* ptr, size_t size)
+{
+    if(ptr == NULL)
+        return kvp_arena_alloc(arena, size);
+    arena_header* header = (arena_header*)ptr - 1;
+    size_t old = align_size(header->size);
+    if(ptr == arena->last) {
+        // the last allocation grows in place while the block has room
+        struct kvp_arena_block* block = arena->blocks;
+        size_t grown = align_size(size);
+        if(grown <= old || grown - old <= block->size - block->fill) {
+            block->fill = block->fill - old + grown;
+            arena->used = arena->used - old + grown;
+            if(arena->used > arena->high_water)
+                arena->high_water = arena->used;
+            header->size = size;
+            return ptr;
+        }
+    } else if(size <= header->size) {
+        return ptr;
+    }
+    void* p = kvp_arena_alloc(arena, size);
+    if(p != NULL)
+        memcpy(p, ptr, header->size < size ? header->size : size);
+    return p;
+}
+
+void kvp_arena_free(kvp_arena* arena, void* ptr)
+{
+    if(ptr == NULL || ptr != arena->last)
+        return;
+    arena_header* header = (arena_header*)ptr - 1;
+    size_t need = sizeof(arena_header) + align_size(header->size);
+    arena->blocks->fill -= need;
+    arena->used -= need;
+    arena->last = NULL;
+}
+
+size_t kvp_arena_high_water(const kvp_arena* arena)
+{
+    return arena->high_water;
+}
+
+static void* arena_malloc(void* user, size_t size)
+{
+    return kvp_arena_alloc((kvp_arena*)user, size);
+}
+
+static void* arena_realloc(void* user, void* ptr, size_t size)
+{
+    return kvp_arena_realloc((kvp_arena*)user, ptr, size);
+}
+
+static void arena_free(void* user, void* ptr)
+{
+    kvp_arena_free((kvp_arena*)user, ptr);
+}
+
+kvp_allocator kvp_arena_allocator(kvp_arena* arena)
+{
+    kvp_allocator a;
+    a.malloc = malloc;
+    a.realloc = realloc;
+    a.free = free;
+    a.user = arena;
+    a.malloc_user = arena_malloc;
+    a.realloc_user = arena_realloc;
+    a.free_user = arena_free;
+    return a;
+}
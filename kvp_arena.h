@@ -0,0 +1,94 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2022, Viktor Borodin
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+ *  Arena (bump) allocator: allocations come from large blocks and are
+ *  released all at once by kvp_arena_reset.
+ */
+
+#ifndef __KVP_ARENA_H__
+#define __KVP_ARENA_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include "kvp_parser.h"
+
+/*
+ * default size of the arena block
+ * */
+#define KVP_ARENA_BLOCK_SIZE (64 * 1024)
+
+struct kvp_arena_block;
+
+typedef struct kvp_arena {
+    struct kvp_arena_block *blocks; /// block allocated from first
+    size_t block_size; /// size of new blocks
+    size_t used; /// bytes allocated since reset, with headers
+    size_t high_water; /// maximum of used
+    size_t blocks_size; /// bytes held in blocks
+    void *last; /// the last allocation, may be grown or freed in place
+} kvp_arena;
+
+/*
+ * create arena with blocks of block_size bytes (KVP_ARENA_BLOCK_SIZE if 0);
+ * returns NULL if out of memory
+ * */
+kvp_arena *kvp_arena_create(size_t block_size);
+
+/*
+ * release all allocations of the arena at once; blocks are kept, after
+ * the arena grew to several blocks they are replaced by one block
+ * fitting the high-water mark, so later documents of the same size do
+ * not call malloc
+ * */
+void kvp_arena_reset(kvp_arena *arena);
+
+void kvp_arena_destroy(kvp_arena *arena);
+
+/*
+ * allocate size bytes aligned for any type; NULL if out of memory
+ * */
+void *kvp_arena_alloc(kvp_arena *arena, size_t size);
+void *kvp_arena_realloc(kvp_arena *arena, void *ptr, size_t size);
+/*
+ * free is a no-op except for the last allocation
+ * */
+void kvp_arena_free(kvp_arena *arena, void *ptr);
+
+/*
+ * maximum bytes in use between resets since arena was created
+ * */
+size_t kvp_arena_high_water(const kvp_arena *arena);
+
+/*
+ * allocator taking memory from the arena, for kvp_set_allocator;
+ * iterators using it must be closed before kvp_arena_reset
+ * */
+kvp_allocator kvp_arena_allocator(kvp_arena *arena);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif /* __cplusplus */
+
+#endif // __KVP_ARENA_H__
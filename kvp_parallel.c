@@ -0,0 +1,243 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2022, Viktor Borodin
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "kvp_parallel.h"
+#include "kvp_simd.h"
+
+// state shared by workers of one call
+struct parallel_run {
+    const char* buffer;
+    kvp_document_cb cb;
+    void* user;
+    struct kvp_allocator alloc;
+
+    atomic_size_t failed; /// smallest index of failed document, SIZE_MAX if none
+    pthread_mutex_t lock;
+    size_t lineno; /// line of the error in failed document
+    char errmsg[LEN_ERROR_MSG];
+};
+
+// part of the input read by one worker
+struct parallel_chunk {
+    size_t begin; /// first byte, at line start
+    size_t end;
+    size_t lines; /// newlines in chunk
+    size_t documents; /// non-blank lines in chunk
+    size_t first_line; /// line of begin in whole input
+    size_t first_document; /// index of the first document in chunk
+    pthread_t thread;
+    struct parallel_run* run;
+};
+
+/* Returns end of the line starting at pos (position of '\n' or end) */
+static size_t line_end(const char* buffer, size_t pos, size_t end)
+{
+    const char* nl = (const char*)memchr(buffer + pos, '\n', end - pos);
+    return nl != NULL ? (size_t)(nl - buffer) : end;
+}
+
+static bool is_blank(const char* line, size_t length)
+{
+    return kvp_skip_space(line, length, NULL) == length;
+}
+
+/* First pass: lines and documents of the chunk */
+static void* count_chunk(void* arg)
+{
+    struct parallel_chunk* chunk = (struct parallel_chunk*)arg;
+    const char* buffer = chunk->run->buffer;
+    for(size_t pos = chunk->begin; pos < chunk->end;) {
+        size_t end = line_end(buffer, pos, chunk->end);
+        if(!is_blank(buffer + pos, end - pos))
+            chunk->documents++;
+        if(end < chunk->end)
+            chunk->lines++;
+        pos = end + 1;
+    }
+    return NULL;
+}
+
+/* Keeps error of document index if it is the first failed one */
+static void fail(struct parallel_run* run, size_t index, size_t lineno, const char* errmsg)
+{
+    pthread_mutex_lock(&run->lock);
+    if(index < atomic_load(&run->failed)) {
+        atomic_store(&run->failed, index);
+        run->lineno = lineno;
+        snprintf(run->errmsg, sizeof(run->errmsg), "%s", errmsg);
+    }
+    pthread_mutex_unlock(&run->lock);
+}
+
+/* Second pass: calls back for documents of the chunk */
+static void* parse_chunk(void* arg)
+{
+    struct parallel_chunk* chunk = (struct parallel_chunk*)arg;
+    struct parallel_run* run = chunk->run;
+    const char* buffer = run->buffer;
+    size_t index = chunk->first_document;
+    size_t lineno = chunk->first_line;
+    kvp_iterator json;
+    bool opened = false;
+
+    for(size_t pos = chunk->begin; pos < chunk->end; lineno++) {
+        size_t end = line_end(buffer, pos, chunk->end);
+        const char* line = buffer + pos;
+        size_t length = end - pos;
+        pos = end + 1;
+        if(is_blank(line, length))
+            continue;
+        // documents after the failed one are not needed
+        if(index > atomic_load(&run->failed))
+            break;
+
+        if(!opened) {
+            kvp_open_buffer(&json, line, length);
+            kvp_set_allocator(&json, &run->alloc);
+            opened = true;
+        } else {
+            kvp_reopen_buffer(&json, line, length);
+        }
+        int r = run->cb(&json, index, run->user);
+        if(r != 0 || (json.flags & JSON_FLAG_ERROR)) {
+            fail(run, index, lineno + kvp_get_lineno(&json), json.errmsg[0] != '\0' ? json.errmsg : "stopped by callback");
+            break;
+        }
+        index++;
+    }
+    if(opened)
+        kvp_close(&json);
+    return NULL;
+}
+
+/* Runs fn for each chunk, the first one in the calling thread */
+static void run_chunks(struct parallel_chunk* chunks, size_t n, void* (*fn)(void*))
+{
+    bool* started = (bool*)calloc(n, sizeof(bool));
+    for(size_t k = 1; k < n; k++)
+        if(started != NULL)
+            started[k] = pthread_create(&chunks[k].thread, NULL, fn, &chunks[k]) == 0;
+    fn(&chunks[0]);
+    for(size_t k = 1; k < n; k++) {
+        if(started != NULL && started[k])
+            pthread_join(chunks[k].thread, NULL);
+        else
+            fn(&chunks[k]);
+    }
+    free(started);
+}
+
+int kvp_parallel_for_each_document(kvp_iterator* json, int threads, kvp_document_cb cb, void* user,
+    size_t* error_document)
+{
+    if(json->flags & JSON_FLAG_ERROR)
+        return -1;
+    if(json->source.kind != KVP_SOURCE_BUFFER && json->source.kind != KVP_SOURCE_MMAP) {
+        json_error(json, "%s", "parallel parsing needs buffer or mmap source");
+        return -1;
+    }
+
+    size_t begin = json->source.position;
+    size_t length = json->source.source.buffer.length;
+    if(begin > length)
+        begin = length;
+    if(threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    size_t n = (size_t)threads;
+    if((length - begin) / KVP_PARALLEL_MIN_CHUNK < n)
+        n = (length - begin) / KVP_PARALLEL_MIN_CHUNK;
+    if(n == 0)
+        n = 1;
+
+    struct parallel_chunk* chunks = (struct parallel_chunk*)kvp_malloc(&json->alloc, n * sizeof(*chunks));
+    if(chunks == NULL) {
+        json_error(json, "%s", "out of memory");
+        return -1;
+    }
+
+    struct parallel_run run;
+    run.buffer = json->source.source.buffer.buffer;
+    run.cb = cb;
+    run.user = user;
+    run.alloc = json->alloc;
+    atomic_init(&run.failed, SIZE_MAX);
+    pthread_mutex_init(&run.lock, NULL);
+    run.lineno = 0;
+    run.errmsg[0] = '\0';
+
+    // chunks of equal size moved to the start of the next line
+    for(size_t k = 0; k < n; k++) {
+        struct parallel_chunk* chunk = &chunks[k];
+        chunk->begin = k == 0 ? begin : chunks[k - 1].end;
+        if(k == n - 1) {
+            chunk->end = length;
+        } else {
+            size_t end = begin + (length - begin) / n * (k + 1);
+            if(end < chunk->begin)
+                end = chunk->begin;
+            end = line_end(run.buffer, end, length);
+            chunk->end = end < length ? end + 1 : length;
+        }
+        chunk->lines = 0;
+        chunk->documents = 0;
+        chunk->run = &run;
+    }
+
+    run_chunks(chunks, n, count_chunk);
+    size_t lineno = kvp_get_lineno(json);
+    size_t index = 0;
+    for(size_t k = 0; k < n; k++) {
+        chunks[k].first_line = lineno;
+        chunks[k].first_document = index;
+        lineno += chunks[k].lines;
+        index += chunks[k].documents;
+    }
+    run_chunks(chunks, n, parse_chunk);
+
+    int result = 0;
+    size_t failed = atomic_load(&run.failed);
+    if(failed != SIZE_MAX) {
+        json->lineno = run.lineno;
+        json_error(json, "document %zu: %s", failed, run.errmsg);
+        if(error_document != NULL)
+            *error_document = failed;
+        result = -1;
+    } else {
+        json->lineno = lineno;
+        json->source.position = length;
+        json->source.line_position = length;
+    }
+    pthread_mutex_destroy(&run.lock);
+    kvp_free(&json->alloc, chunks);
+    return result;
+}
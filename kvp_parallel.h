@@ -0,0 +1,66 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2022, Viktor Borodin
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+ *  Parallel parsing of newline delimited input: one object per line.
+ */
+
+#ifndef __KVP_PARALLEL_H__
+#define __KVP_PARALLEL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include "kvp_parser.h"
+
+/*
+ * inputs smaller than this per thread are parsed by fewer threads
+ * */
+#define KVP_PARALLEL_MIN_CHUNK (64 * 1024)
+
+/*
+ * function called for each document (non-blank line) of the input with
+ * iterator opened over the line; index is number of the document from
+ * the start; returns 0 to go on, non-zero to stop with error
+ * */
+typedef int (*kvp_document_cb)(kvp_iterator *json, size_t index, void *user);
+
+/*
+ * call cb for each document of buffer or mmap source of the iterator,
+ * from its current position, in threads (number of online CPUs if 0);
+ * input is split into chunks at line boundaries, each thread reads its
+ * chunk with own iterator using allocator of json (must be thread safe)
+ * and calls cb for its documents in order; documents of different
+ * chunks are processed concurrently.
+ * Returns 0 on success, -1 on error: error of the first failed document
+ * is set to json with "document N: " prefix and its line in the whole
+ * input (see kvp_get_lineno), N is stored to *error_document if not NULL
+ * */
+int kvp_parallel_for_each_document(kvp_iterator *json, int threads, kvp_document_cb cb, void *user,
+    size_t *error_document);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif /* __cplusplus */
+
+#endif // __KVP_PARALLEL_H__
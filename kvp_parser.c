@@ -26,16 +26,46 @@ SOFTWARE.
 
 */
 
+#if !defined(_WIN32) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // strtod_l
+#endif
+
 #include <ctype.h>
+#include <errno.h>
+#include <float.h>
+#include <limits.h>
+#include <locale.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef _WIN32
+#include <intrin.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// mappings of at least this size are aligned to huge page boundary
+#define KVP_HUGE_PAGE_SIZE (2u * 1024 * 1024)
+
 #include "kvp_parser.h"
+#include "kvp_simd.h"
+#include "kvphash_table.h"
+
+// counters of kvp_get_stats, no code without KVP_STATS
+#ifdef KVP_STATS
+#define KVP_COUNT(json, counter, n) ((json)->stats.counter += (n))
+#else
+#define KVP_COUNT(json, counter, n) ((void)0)
+#endif
 
 static int buffer_peek(struct json_source* source)
 {
     if(source->position < source->source.buffer.length)
-        return source->source.buffer.buffer[source->position];
+        return (unsigned char)source->source.buffer.buffer[source->position];
     else
         return EOF;
 }
@@ -47,6 +77,23 @@ static int buffer_get(struct json_source* source)
     return c;
 }
 
+/* Buffer access of feed mode, marks reaching of the window end */
+static int feed_peek(struct json_source* source)
+{
+    if(source->position < source->source.buffer.length)
+        return (unsigned char)source->source.buffer.buffer[source->position];
+    source->source.buffer.eof = true;
+    return EOF;
+}
+
+static int feed_get(struct json_source* source)
+{
+    int c = feed_peek(source);
+    if(c != EOF)
+        source->position++;
+    return c;
+}
+
 static int stream_get(struct json_source* source)
 {
     source->position++;
@@ -60,6 +107,180 @@ static int stream_peek(struct json_source* source)
     return c;
 }
 
+/* Reads the next block from descriptor, returns false on end of file or error */
+static bool fd_refill(struct json_source* source)
+{
+    if(source->source.fd.error != 0)
+        return false;
+
+    if(source->source.fd.block == NULL) {
+        source->source.fd.block = (char*)kvp_malloc(source->source.fd.alloc, source->source.fd.block_size);
+        if(source->source.fd.block == NULL) {
+            source->source.fd.error = ENOMEM;
+            return false;
+        }
+    }
+
+    // newlines of the block are counted before it is replaced
+    size_t start = source->position - source->source.fd.offset;
+    if(source->line_position >= start && source->line_position - start < source->source.fd.fill) {
+        size_t from = source->line_position - start;
+        source->lines += kvp_count_newlines(source->source.fd.block + from, source->source.fd.fill - from);
+    }
+    for(size_t i = source->source.fd.fill; i > 0; i--) {
+        if(source->source.fd.block[i - 1] == '\n') {
+            source->source.fd.line_start = start + i;
+            break;
+        }
+    }
+    source->line_position = source->position;
+
+    source->source.fd.offset = 0;
+    source->source.fd.fill = 0;
+    while(1) {
+        long n = read(source->source.fd.fd, source->source.fd.block, source->source.fd.block_size);
+        if(n >= 0) {
+            source->source.fd.fill = (size_t)n;
+            return n > 0;
+        }
+        if(errno != EINTR) {
+            source->source.fd.error = errno;
+            return false;
+        }
+    }
+}
+
+static int fd_peek(struct json_source* source)
+{
+    if(source->source.fd.offset == source->source.fd.fill && !fd_refill(source))
+        return EOF;
+    return (unsigned char)source->source.fd.block[source->source.fd.offset];
+}
+
+static int fd_get(struct json_source* source)
+{
+    int c = fd_peek(source);
+    if(c != EOF) {
+        source->source.fd.offset++;
+        source->position++;
+    }
+    return c;
+}
+
+/* Next byte of the source, EOF at the end: bytes in memory (buffer,
+ * mapped file, fed chunk, block of descriptor) are read in place without
+ * calls, only stream and user sources call their functions */
+static inline int source_peek(struct json_source* source)
+{
+    switch(source->kind) {
+    case KVP_SOURCE_BUFFER:
+    case KVP_SOURCE_MMAP:
+        return buffer_peek(source);
+    case KVP_SOURCE_FEED:
+        return feed_peek(source);
+    case KVP_SOURCE_FD:
+        if(source->source.fd.offset < source->source.fd.fill)
+            return (unsigned char)source->source.fd.block[source->source.fd.offset];
+        return fd_peek(source);
+    default:
+        return source->peek(source);
+    }
+}
+
+/* Consumes the next byte of the source as source_peek and returns it */
+static inline int source_get(struct json_source* source)
+{
+    switch(source->kind) {
+    case KVP_SOURCE_BUFFER:
+    case KVP_SOURCE_MMAP:
+        return source->position < source->source.buffer.length
+                   ? (unsigned char)source->source.buffer.buffer[source->position++]
+                   : (source->position++, EOF);
+    case KVP_SOURCE_FEED:
+        return feed_get(source);
+    case KVP_SOURCE_FD:
+        if(source->source.fd.offset < source->source.fd.fill) {
+            source->position++;
+            return (unsigned char)source->source.fd.block[source->source.fd.offset++];
+        }
+        return fd_get(source);
+    default:
+        return source->get(source);
+    }
+}
+
+/* Sets *window to the unread bytes available in memory and returns their
+ * number; 0 for sources which are read byte by byte or at end of input */
+static size_t source_window(struct json_source* source, const char** window)
+{
+    switch(source->kind) {
+    case KVP_SOURCE_BUFFER:
+    case KVP_SOURCE_MMAP:
+    case KVP_SOURCE_FEED:
+        if(source->position >= source->source.buffer.length)
+            return 0;
+        *window = source->source.buffer.buffer + source->position;
+        return source->source.buffer.length - source->position;
+    case KVP_SOURCE_FD:
+        if(source->source.fd.offset == source->source.fd.fill && !fd_refill(source))
+            return 0;
+        *window = source->source.fd.block + source->source.fd.offset;
+        return source->source.fd.fill - source->source.fd.offset;
+    default:
+        return 0;
+    }
+}
+
+/* Is whole input (or feed window) in memory to keep data as view */
+static bool source_in_memory(const struct json_source* source)
+{
+    return source->kind == KVP_SOURCE_BUFFER || source->kind == KVP_SOURCE_MMAP || source->kind == KVP_SOURCE_FEED;
+}
+
+/* Consumes n bytes of the window returned by source_window */
+static void source_skip(struct json_source* source, size_t n)
+{
+    source->position += n;
+    if(source->kind == KVP_SOURCE_FD)
+        source->source.fd.offset += n;
+}
+
+/* Are newlines of the source counted from positions when line is asked:
+ * bytes in memory are, bytes of stream and user sources are counted
+ * while whitespace is read */
+static bool source_counts_lines(const struct json_source* source)
+{
+    return source_in_memory(source) || source->kind == KVP_SOURCE_FD;
+}
+
+/* Adds newlines of the bytes read since the last count to lineno */
+static void count_lines(kvp_iterator* json)
+{
+    struct json_source* source = &json->source;
+    if(source_in_memory(source)) {
+        size_t end = source->position < source->source.buffer.length ? source->position : source->source.buffer.length;
+        if(source->line_position < end)
+            json->lineno += kvp_count_newlines(source->source.buffer.buffer + source->line_position, end - source->line_position);
+        source->line_position = source->position;
+    } else if(source->kind == KVP_SOURCE_FD) {
+        size_t start = source->position - source->source.fd.offset;
+        json->lineno += source->lines;
+        source->lines = 0;
+        if(source->line_position >= start && source->line_position - start < source->source.fd.offset) {
+            size_t from = source->line_position - start;
+            json->lineno += kvp_count_newlines(source->source.fd.block + from, source->source.fd.offset - from);
+        }
+        source->line_position = source->position;
+    }
+}
+
+static void reset_lines(kvp_iterator* json)
+{
+    json->lineno = 0;
+    json->source.line_position = 0;
+    json->source.lines = 0;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void kvp_open_buffer(kvp_iterator* json, const void* buffer, size_t size)
@@ -67,8 +288,120 @@ void kvp_open_buffer(kvp_iterator* json, const void* buffer, size_t size)
     init_iterator(json);
     json->source.get = buffer_get;
     json->source.peek = buffer_peek;
+    json->source.kind = KVP_SOURCE_BUFFER;
+    json->source.source.buffer.buffer = (const char*)buffer;
+    json->source.source.buffer.length = size;
+    json->source.source.buffer.map = NULL;
+    json->source.source.buffer.map_length = 0;
+}
+
+void kvp_reopen_buffer(kvp_iterator* json, const void* buffer, size_t size)
+{
+    kvp_reset_iterator(json);
+    reset_lines(json);
+    json->isKey = true;
+    json->data.view = NULL;
+    json->data.string_fill = 0;
+    json->source.position = 0;
+    json->source.get = buffer_get;
+    json->source.peek = buffer_peek;
+    json->source.kind = KVP_SOURCE_BUFFER;
     json->source.source.buffer.buffer = (const char*)buffer;
     json->source.source.buffer.length = size;
+    json->source.source.buffer.map = NULL;
+    json->source.source.buffer.map_length = 0;
+}
+
+void kvp_open_feed(kvp_iterator* json)
+{
+    kvp_open_buffer(json, "", 0);
+    json->source.get = feed_get;
+    json->source.peek = feed_peek;
+    json->source.kind = KVP_SOURCE_FEED;
+    json->source.source.buffer.chunk = NULL;
+    json->source.source.buffer.chunk_length = 0;
+    json->source.source.buffer.chunk_offset = 0;
+    json->source.source.buffer.carry = NULL;
+    json->source.source.buffer.carry_fill = 0;
+    json->source.source.buffer.carry_size = 0;
+    json->source.source.buffer.carry_chunk = 0;
+    json->source.source.buffer.final = false;
+    json->source.source.buffer.eof = false;
+    json->source.source.buffer.unread = false;
+}
+
+/* Moves up to n more bytes of the chunk to the carry, which becomes
+ * the window; returns false if out of memory */
+static bool feed_carry(kvp_iterator* json, size_t n)
+{
+    struct json_source* source = &json->source;
+    if(n > source->source.buffer.chunk_length - source->source.buffer.chunk_offset)
+        n = source->source.buffer.chunk_length - source->source.buffer.chunk_offset;
+    if(source->source.buffer.carry_fill + n > source->source.buffer.carry_size || source->source.buffer.carry == NULL) {
+        size_t size = source->source.buffer.carry_size > 0 ? source->source.buffer.carry_size * 2 : 4096;
+        while(size < source->source.buffer.carry_fill + n)
+            size *= 2;
+        char* carry = (char*)kvp_realloc(&json->alloc, source->source.buffer.carry, size);
+        if(carry == NULL) {
+            json_error(json, "%s", "out of memory");
+            return false;
+        }
+        source->source.buffer.carry = carry;
+        source->source.buffer.carry_size = size;
+    }
+    memcpy(source->source.buffer.carry + source->source.buffer.carry_fill,
+        source->source.buffer.chunk + source->source.buffer.chunk_offset, n);
+    source->source.buffer.carry_fill += n;
+    source->source.buffer.carry_chunk += n;
+    source->source.buffer.chunk_offset += n;
+    source->source.buffer.buffer = source->source.buffer.carry;
+    source->source.buffer.length = source->source.buffer.carry_fill;
+    return true;
+}
+
+int kvp_feed(kvp_iterator* json, const void* chunk, size_t length)
+{
+    struct json_source* source = &json->source;
+    if(json->flags & JSON_FLAG_ERROR)
+        return -1;
+    if(source->kind != KVP_SOURCE_FEED) {
+        json_error(json, "%s", "iterator is not in feed mode");
+        return -1;
+    }
+    if(source->source.buffer.final) {
+        json_error(json, "%s", "input was ended");
+        return -1;
+    }
+    if(source->source.buffer.unread) {
+        // its pairs would be dropped with the window
+        json_error(json, "%s", "previous chunk is not read");
+        return -1;
+    }
+    if(chunk == NULL || length == 0) {
+        source->source.buffer.final = true;
+        chunk = "";
+        length = 0;
+    }
+    KVP_COUNT(json, bytes, length);
+    source->source.buffer.chunk = (const char*)chunk;
+    source->source.buffer.chunk_length = length;
+    source->source.buffer.chunk_offset = 0;
+    source->source.buffer.carry_chunk = 0;
+    source->source.buffer.unread = true;
+
+    if(source->source.buffer.carry_fill > 0) {
+        // incomplete pair is continued in the carry with start of the chunk
+        size_t n = source->source.buffer.carry_fill > 4096 ? source->source.buffer.carry_fill : 4096;
+        if(!feed_carry(json, n))
+            return -1;
+    } else {
+        source->source.buffer.buffer = (const char*)chunk;
+        source->source.buffer.length = length;
+        source->source.buffer.chunk_offset = length;
+    }
+    source->position = 0;
+    source->line_position = 0;
+    return 0;
 }
 
 void kvp_open_string(kvp_iterator* json, const char* string)
@@ -81,12 +414,113 @@ void kvp_open_stream(kvp_iterator* json, FILE* stream)
     init_iterator(json);
     json->source.get = stream_get;
     json->source.peek = stream_peek;
+    json->source.kind = KVP_SOURCE_STREAM;
     json->source.source.stream.stream = stream;
 }
 
+void kvp_open_fd(kvp_iterator* json, int fd, size_t block_size)
+{
+    init_iterator(json);
+    json->source.get = fd_get;
+    json->source.peek = fd_peek;
+    json->source.kind = KVP_SOURCE_FD;
+    json->source.source.fd.fd = fd;
+    json->source.source.fd.block = NULL;
+    json->source.source.fd.block_size = block_size != 0 ? block_size : KVP_FD_BLOCK_SIZE;
+    json->source.source.fd.fill = 0;
+    json->source.source.fd.offset = 0;
+    json->source.source.fd.error = 0;
+    json->source.source.fd.line_start = 0;
+    // block is allocated lazily, so allocator may be set after open
+    json->source.source.fd.alloc = &json->alloc;
+
+#if defined(POSIX_FADV_SEQUENTIAL)
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+}
+
+#ifndef _WIN32
+/* Maps length bytes of fd, aligned to huge page when the file is large enough
+ * for the kernel to back it with huge pages */
+static void* map_file(int fd, size_t length)
+{
+#if defined(MADV_HUGEPAGE)
+    if(length >= KVP_HUGE_PAGE_SIZE) {
+        // reserve address range with room for alignment and map file over it
+        size_t reserve = length + KVP_HUGE_PAGE_SIZE;
+        char* area = mmap(NULL, reserve, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(area != MAP_FAILED) {
+            char* aligned = (char*)(((size_t)area + KVP_HUGE_PAGE_SIZE - 1) & ~((size_t)KVP_HUGE_PAGE_SIZE - 1));
+            void* map = mmap(aligned, length, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0);
+            if(map != MAP_FAILED) {
+                size_t page = (size_t)sysconf(_SC_PAGESIZE);
+                size_t mapped = (length + page - 1) & ~(page - 1);
+                if(aligned != area)
+                    munmap(area, aligned - area);
+                if(aligned + mapped < area + reserve)
+                    munmap(aligned + mapped, area + reserve - (aligned + mapped));
+                madvise(map, length, MADV_HUGEPAGE);
+                return map;
+            }
+            munmap(area, reserve);
+        }
+    }
+#endif
+    void* map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    return map == MAP_FAILED ? NULL : map;
+}
+#endif /* _WIN32 */
+
+int kvp_open_mmap(kvp_iterator* json, const char* path)
+{
+    kvp_open_buffer(json, "", 0);
+    json->source.kind = KVP_SOURCE_MMAP;
+
+#ifdef _WIN32
+    json_error(json, "%s", "memory mapped input is not supported");
+    return -1;
+#else
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        json_error(json, "cannot open %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        json_error(json, "cannot map %s: not a regular file", path);
+        close(fd);
+        return -1;
+    }
+
+    size_t length = (size_t)st.st_size;
+    if(length == 0) {
+        // nothing to map, iterator reads empty buffer
+        close(fd);
+        return 0;
+    }
+
+    void* map = map_file(fd, length);
+    close(fd); // mapping keeps the file referenced
+    if(map == NULL) {
+        json_error(json, "cannot map %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    madvise(map, length, MADV_SEQUENTIAL);
+    madvise(map, length, MADV_WILLNEED);
+
+    json->source.source.buffer.buffer = (const char*)map;
+    json->source.source.buffer.length = length;
+    json->source.source.buffer.map = map;
+    json->source.source.buffer.map_length = length;
+    return 0;
+#endif /* _WIN32 */
+}
+
 void init_iterator(kvp_iterator* json)
 {
-    json->lineno = 0;
+    reset_lines(json);
     json->flags = JSON_FLAG_STREAMING;
 
     json->errmsg[0] = '\0';
@@ -94,50 +528,77 @@ void init_iterator(kvp_iterator* json)
     json->data.string = NULL;
     json->data.string_size = 0;
     json->data.string_fill = 0;
+    json->data.view = NULL;
+    json->data.view_length = 0;
+    json->data.key = NULL;
+    json->data.key_size = 0;
+    json->data.batch = NULL;
+    json->data.batch_fill = 0;
+    json->data.batch_size = 0;
     json->source.position = 0;
 
     json->isKey = true;
+    json->filter = NULL;
+    json->keys = NULL;
+    json->key_id = 0;
+    memset(&json->shapes, 0, sizeof(json->shapes));
+    memset(&json->stats, 0, sizeof(json->stats));
+    kvp_reset_iterator(json);
 
     json->alloc.malloc = malloc;
     json->alloc.realloc = realloc;
     json->alloc.free = free;
-}
-
-static enum kvp_json_type is_match_pair(kvp_iterator* json, const char* pattern, enum kvp_json_type type)
-{
-    int c;
-    for(const char* p = pattern; *p; p++) {
-        if(*p != (c = json->source.get(&json->source))) {
-            json_error(json, "expected '%c' instead of byte '%c'", *p, c);
-            return JSON_ERROR;
-        }
-    }
-    return type;
+    json->alloc.user = NULL;
+    json->alloc.malloc_user = NULL;
+    json->alloc.realloc_user = NULL;
+    json->alloc.free_user = NULL;
 }
 
 static int pushchar(kvp_iterator* json, int c)
 {
     if(json->data.string_fill == json->data.string_size) {
         size_t size = json->data.string_size * 2;
-        char* buffer = (char*)json->alloc.realloc(json->data.string, size);
+        char* buffer = (char*)kvp_realloc(&json->alloc, json->data.string, size);
         if(buffer == NULL) {
             json_error(json, "%s", "out of memory");
             return -1;
         } else {
             json->data.string_size = size;
             json->data.string = buffer;
+            KVP_COUNT(json, reallocs, 1);
         }
     }
     json->data.string[json->data.string_fill++] = c;
     return 0;
 }
 
+static int pushchars(kvp_iterator* json, const char* chars, size_t n)
+{
+    if(json->data.string_fill + n > json->data.string_size) {
+        size_t size = json->data.string_size * 2;
+        while(size < json->data.string_fill + n)
+            size *= 2;
+        char* buffer = (char*)kvp_realloc(&json->alloc, json->data.string, size);
+        if(buffer == NULL) {
+            json_error(json, "%s", "out of memory");
+            return -1;
+        }
+        json->data.string_size = size;
+        json->data.string = buffer;
+        KVP_COUNT(json, reallocs, 1);
+    }
+    memcpy(json->data.string + json->data.string_fill, chars, n);
+    json->data.string_fill += n;
+    return 0;
+}
+
 static int init_string(kvp_iterator* json)
 {
+    json->data.view = NULL;
     json->data.string_fill = 0;
     if(json->data.string == NULL) {
         json->data.string_size = 1024;
-        json->data.string = (char*)json->alloc.malloc(json->data.string_size);
+        json->data.string = (char*)kvp_malloc(&json->alloc, json->data.string_size);
         if(json->data.string == NULL) {
             json_error(json, "%s", "out of memory");
             return -1;
@@ -147,26 +608,65 @@ static int init_string(kvp_iterator* json)
     return 0;
 }
 
+/* Keeps text of true/false/null value ("1" or "0") as data view */
+static void set_literal(kvp_iterator* json, enum kvp_json_type type)
+{
+    json->data.view = type == JSON_TRUE ? "1" : "0";
+    json->data.view_length = 1;
+}
+
+/* Reads the rest of literal (n bytes after its first one) as value of
+ * type; in memory it is compared at once */
+static enum kvp_json_type read_literal(kvp_iterator* json, const char* rest, size_t n, enum kvp_json_type type)
+{
+    json->type = type;
+    set_literal(json, type);
+
+    const char* window;
+    if(source_in_memory(&json->source) && source_window(&json->source, &window) >= n && memcmp(window, rest, n) == 0) {
+        source_skip(&json->source, n);
+        return type;
+    }
+    int c;
+    for(const char* p = rest; p < rest + n; p++) {
+        if(*p != (c = source_get(&json->source))) {
+            json_error(json, "expected '%c' instead of byte '%c'", *p, c);
+            return JSON_ERROR;
+        }
+    }
+    return type;
+}
+
 static int encode_utf8(kvp_iterator* json, unsigned long c)
 {
+    char buf[4];
+    size_t n;
     if(c < 0x80UL) {
         return pushchar(json, c);
     } else if(c < 0x0800UL) {
-        return !((pushchar(json, (c >> 6 & 0x1F) | 0xC0) == 0) && (pushchar(json, (c >> 0 & 0x3F) | 0x80) == 0));
+        buf[0] = (c >> 6 & 0x1F) | 0xC0;
+        buf[1] = (c >> 0 & 0x3F) | 0x80;
+        n = 2;
     } else if(c < 0x010000UL) {
         if(c >= 0xd800 && c <= 0xdfff) {
             json_error(json, "invalid codepoint %06lx", c);
             return -1;
         }
-        return !((pushchar(json, (c >> 12 & 0x0F) | 0xE0) == 0) && (pushchar(json, (c >> 6 & 0x3F) | 0x80) == 0) &&
-            (pushchar(json, (c >> 0 & 0x3F) | 0x80) == 0));
+        buf[0] = (c >> 12 & 0x0F) | 0xE0;
+        buf[1] = (c >> 6 & 0x3F) | 0x80;
+        buf[2] = (c >> 0 & 0x3F) | 0x80;
+        n = 3;
     } else if(c < 0x110000UL) {
-        return !((pushchar(json, (c >> 18 & 0x07) | 0xF0) == 0) && (pushchar(json, (c >> 12 & 0x3F) | 0x80) == 0) &&
-            (pushchar(json, (c >> 6 & 0x3F) | 0x80) == 0) && (pushchar(json, (c >> 0 & 0x3F) | 0x80) == 0));
+        buf[0] = (c >> 18 & 0x07) | 0xF0;
+        buf[1] = (c >> 12 & 0x3F) | 0x80;
+        buf[2] = (c >> 6 & 0x3F) | 0x80;
+        buf[3] = (c >> 0 & 0x3F) | 0x80;
+        n = 4;
     } else {
         json_error(json, "unable to encode %06lx as UTF-8", c);
         return -1;
     }
+    return pushchars(json, buf, n);
 }
 
 static long read_unicode_cp(kvp_iterator* json)
@@ -175,7 +675,7 @@ static long read_unicode_cp(kvp_iterator* json)
     int shift = 12;
 
     for(size_t i = 0; i < 4; i++) {
-        int c = json->source.get(&json->source);
+        int c = source_get(&json->source);
         int hc;
 
         if(c == EOF) {
@@ -197,7 +697,17 @@ static int read_unicode(kvp_iterator* json)
 {
     long cp, h, l;
 
-    if((cp = read_unicode_cp(json)) == -1) {
+    // whole \uXXXX group (and \uXXXX\uXXXX surrogate pair) from memory
+    const char* window;
+    size_t n = source_window(&json->source, &window);
+    if(n >= 4 && (cp = getxdigits4(window)) >= 0) {
+        source_skip(&json->source, 4);
+        if(cp >= 0xd800 && cp <= 0xdbff && n >= 10 && window[4] == '\\' && window[5] == 'u' &&
+            (l = getxdigits4(window + 6)) >= 0xdc00 && l <= 0xdfff) {
+            source_skip(&json->source, 6);
+            return encode_utf8(json, ((cp - 0xd800) * 0x400) + ((l - 0xdc00) + 0x10000));
+        }
+    } else if((cp = read_unicode_cp(json)) == -1) {
         return -1;
     }
 
@@ -207,7 +717,7 @@ static int read_unicode(kvp_iterator* json)
          */
         h = cp;
 
-        int c = json->source.get(&json->source);
+        int c = source_get(&json->source);
         if(c == EOF) {
             json_error(json, "%s", "unterminated string literal in Unicode");
             return -1;
@@ -219,7 +729,7 @@ static int read_unicode(kvp_iterator* json)
             return -1;
         }
 
-        c = json->source.get(&json->source);
+        c = source_get(&json->source);
         if(c == EOF) {
             json_error(json, "%s", "unterminated string literal in Unicode");
             return -1;
@@ -254,7 +764,7 @@ static int read_unicode(kvp_iterator* json)
 
 static int read_escaped(kvp_iterator* json)
 {
-    int c = json->source.get(&json->source);
+    int c = source_get(&json->source);
     if(c == EOF) {
         json_error(json, "%s", "unterminated string literal in escape");
         return -1;
@@ -281,6 +791,7 @@ static int read_escaped(kvp_iterator* json)
             return -1;
         }
     }
+    KVP_COUNT(json, escapes, 1);
     return 0;
 }
 
@@ -296,7 +807,7 @@ static int read_utf8(kvp_iterator* json, int next_char)
     buffer[0] = next_char;
     int i;
     for(i = 1; i < count; ++i) {
-        buffer[i] = json->source.get(&json->source);
+        buffer[i] = source_get(&json->source);
         ;
     }
 
@@ -309,15 +820,55 @@ static int read_utf8(kvp_iterator* json, int next_char)
         if(pushchar(json, buffer[i]) != 0)
             return -1;
     }
+    KVP_COUNT(json, utf8, count > 1);
     return 0;
 }
 
 static enum kvp_json_type read_string(kvp_iterator* json)
 {
+    // bytes before this position are read one by one to report bad UTF-8
+    size_t slow_until = 0;
+
+    // string without escapes in buffer is kept as view, see kvp_get_string
+    if(source_in_memory(&json->source)) {
+        const char* window = NULL;
+        size_t n = source_window(&json->source, &window);
+        size_t run = kvp_scan_string(window, n);
+        if(run < n && window[run] == '"' && kvp_validate_utf8(window, run)) {
+            json->data.view = window;
+            json->data.view_length = run;
+            KVP_COUNT(json, utf8, kvp_count_utf8_leads(window, run));
+            source_skip(&json->source, run + 1);
+            return JSON_STRING;
+        }
+    }
+
     if(init_string(json) != 0)
         return JSON_ERROR;
     while(1) {
-        int c = json->source.get(&json->source);
+        // validate and copy plain run of the string at once, the byte
+        // stopping it is handled below
+        const char* window;
+        size_t n;
+        if(json->source.position >= slow_until && (n = source_window(&json->source, &window)) > 0) {
+            size_t run = kvp_scan_string(window, n);
+            if(run == n)
+                run -= kvp_utf8_incomplete_tail(window, n); // sequence continues in the next block
+            if(run > 0) {
+                if(!kvp_validate_utf8(window, run)) {
+                    slow_until = json->source.position + run;
+                } else {
+                    if(pushchars(json, window, run) != 0)
+                        return JSON_ERROR;
+                    KVP_COUNT(json, utf8, kvp_count_utf8_leads(window, run));
+                    source_skip(&json->source, run);
+                    if(run == n)
+                        continue;
+                }
+            }
+        }
+
+        int c = source_get(&json->source);
         if(c == EOF) {
             json_error(json, "%s", "unterminated string literal");
             return JSON_ERROR;
@@ -345,13 +896,61 @@ static enum kvp_json_type read_string(kvp_iterator* json)
     return JSON_ERROR;
 }
 
-static int read_digits(kvp_iterator* json)
+// part of number the digits belong to
+enum number_part { NUMBER_INT, NUMBER_FRACTION, NUMBER_EXPONENT };
+
+/* Accumulates digit d into the number value while it is scanned */
+static void number_digit(kvp_iterator* json, int d, enum number_part part)
+{
+    struct kvp_number* num = &json->data.number;
+    if(part == NUMBER_EXPONENT) {
+        if(num->exponent_value < 100000) // far out of double range, keep from overflow
+            num->exponent_value = num->exponent_value * 10 + d;
+        return;
+    }
+    if(!num->truncated) {
+        if(num->mantissa <= (UINT64_MAX - d) / 10) {
+            num->mantissa = num->mantissa * 10 + d;
+            if(part == NUMBER_FRACTION)
+                num->exponent--;
+            return;
+        }
+        num->truncated = true;
+    }
+    // digit does not fit into mantissa, only its weight is kept
+    if(part == NUMBER_INT)
+        num->exponent++;
+}
+
+static int read_digits(kvp_iterator* json, bool copy, enum number_part part)
 {
     int c;
     unsigned nread = 0;
-    while(isdigit(c = json->source.peek(&json->source))) {
-        if(pushchar(json, json->source.get(&json->source)) != 0)
+
+    // digits in memory are read by cursor up to the end of the window
+    const char* window;
+    size_t n;
+    while((n = source_window(&json->source, &window)) > 0) {
+        const char* cur = window;
+        const char* end = window + n;
+        while(cur < end && (unsigned)(*cur - '0') < 10) {
+            number_digit(json, *cur - '0', part);
+            cur++;
+        }
+        size_t run = (size_t)(cur - window);
+        if(copy && run > 0 && pushchars(json, window, run) != 0)
+            return -1;
+        source_skip(&json->source, run);
+        nread += (unsigned)run;
+        if(cur < end)
+            break;
+    }
+
+    while(isdigit(c = source_peek(&json->source))) {
+        source_get(&json->source);
+        if(copy && pushchar(json, c) != 0)
             return -1;
+        number_digit(json, c - '0', part);
 
         nread++;
     }
@@ -364,63 +963,81 @@ static int read_digits(kvp_iterator* json)
     return 0;
 }
 
-static enum kvp_json_type read_number(kvp_iterator* json, int c)
+/* Reads number starting with c; text is copied into data if copy is set,
+ * value is accumulated into data.number */
+static enum kvp_json_type read_number(kvp_iterator* json, int c, bool copy)
 {
-    if(pushchar(json, c) != 0)
+    struct kvp_number* num = &json->data.number;
+    num->mantissa = 0;
+    num->exponent = 0;
+    num->exponent_value = 0;
+    num->negative = false;
+    num->integer = true;
+    num->truncated = false;
+
+    if(copy && pushchar(json, c) != 0)
         return JSON_ERROR;
     if(c == '-') {
-        c = json->source.get(&json->source);
-        if(isdigit(c)) {
-            return read_number(json, c);
-        } else {
+        num->negative = true;
+        c = source_get(&json->source);
+        if(!isdigit(c)) {
             json_error(json, "unexpected byte is '%c' in number", c);
             return JSON_ERROR;
         }
-    } else if(strchr("123456789", c) != NULL) {
-        c = json->source.peek(&json->source);
+        if(copy && pushchar(json, c) != 0)
+            return JSON_ERROR;
+    }
+    number_digit(json, c - '0', NUMBER_INT);
+    if(c != '0') {
+        c = source_peek(&json->source);
         if(isdigit(c)) {
-            if(read_digits(json) != 0)
+            if(read_digits(json, copy, NUMBER_INT) != 0)
                 return JSON_ERROR;
         }
     }
     /* Up to decimal or exponent has been read. */
-    c = json->source.peek(&json->source);
+    c = source_peek(&json->source);
     if(strchr(".eE", c) == NULL) {
-        if(pushchar(json, '\0') != 0)
+        if(copy && pushchar(json, '\0') != 0)
             return JSON_ERROR;
         else
             return JSON_NUMBER;
     }
     if(c == '.') {
-        json->source.get(&json->source); // consume .
-        if(pushchar(json, c) != 0)
+        source_get(&json->source); // consume .
+        num->integer = false;
+        if(copy && pushchar(json, c) != 0)
             return JSON_ERROR;
-        if(read_digits(json) != 0)
+        if(read_digits(json, copy, NUMBER_FRACTION) != 0)
             return JSON_ERROR;
     }
     /* Check for exponent. */
-    c = json->source.peek(&json->source);
+    c = source_peek(&json->source);
     if(c == 'e' || c == 'E') {
-        json->source.get(&json->source); // consume e/E
-        if(pushchar(json, c) != 0)
+        source_get(&json->source); // consume e/E
+        num->integer = false;
+        if(copy && pushchar(json, c) != 0)
             return JSON_ERROR;
 
-        c = json->source.peek(&json->source);
+        bool negative = false;
+        c = source_peek(&json->source);
         if(c == '+' || c == '-') {
-            json->source.get(&json->source); // consume
-            if(pushchar(json, c) != 0)
+            source_get(&json->source); // consume
+            negative = c == '-';
+            if(copy && pushchar(json, c) != 0)
                 return JSON_ERROR;
-            if(read_digits(json) != 0)
+            if(read_digits(json, copy, NUMBER_EXPONENT) != 0)
                 return JSON_ERROR;
         } else if(isdigit(c)) {
-            if(read_digits(json) != 0)
+            if(read_digits(json, copy, NUMBER_EXPONENT) != 0)
                 return JSON_ERROR;
         } else {
             json_error(json, "unexpected byte '%c' in number", c);
             return JSON_ERROR;
         }
+        num->exponent += negative ? -num->exponent_value : num->exponent_value;
     }
-    if(pushchar(json, '\0') != 0)
+    if(copy && pushchar(json, '\0') != 0)
         return JSON_ERROR;
     else
         return JSON_NUMBER;
@@ -429,14 +1046,23 @@ static enum kvp_json_type read_number(kvp_iterator* json, int c)
 /* Returns the next non-whitespace character in the stream. */
 static int next_char(kvp_iterator* json)
 {
+    const char* window;
+    size_t n;
+    // newlines of sources in memory are counted later, see count_lines
+    while((n = source_window(&json->source, &window)) > 0) {
+        size_t skip = kvp_skip_space(window, n, NULL);
+        if(skip < n) {
+            source_skip(&json->source, skip + 1);
+            return (unsigned char)window[skip];
+        }
+        source_skip(&json->source, n);
+    }
 
     int c;
-    while(isspace(c = json->source.get(&json->source)))
-        if(c == '\n') {
+    while(isspace(c = source_get(&json->source)))
+        if(c == '\n' && !source_counts_lines(&json->source)) {
             json->lineno++;
-            //printf("line: %zu", json->lineno);
         }
-    // printf("\tNext pair %c:\n", c);
     return c;
 }
 
@@ -448,41 +1074,22 @@ static enum kvp_json_type read_value(kvp_iterator* json, int c)
         json_error(json, "%s", "unexpected end of text");
         return JSON_ERROR;
     case '{':
-
-        return 1;
-        // return push(json, JSON_ARRAY);
     case '[':
-        json_error(json, "%s", "unexpected end of text");
+        json_error(json, "unexpected byte '%c' in value", c);
         return JSON_ERROR;
     case '"':
         json->type = JSON_STRING;
         return read_string(json);
     case 'n':
-        json->type = JSON_NULL;
-        if(pushchar(json, '0') != 0)
-            return JSON_ERROR;
-
-        return is_match_pair(json, "ull", JSON_NULL);
+        return read_literal(json, "ull", 3, JSON_NULL);
     case 'f':
-        json->type = JSON_FALSE;
-        if(pushchar(json, '0') != 0)
-            return JSON_ERROR;
-        return is_match_pair(json, "alse", JSON_FALSE);
+        return read_literal(json, "alse", 4, JSON_FALSE);
     case 'F':
-        if(pushchar(json, '0') != 0)
-            return JSON_ERROR;
-        json->type = JSON_FALSE;
-        return is_match_pair(json, "ALSE", JSON_FALSE);
+        return read_literal(json, "ALSE", 4, JSON_FALSE);
     case 't':
-        json->type = JSON_TRUE;
-        if(pushchar(json, '1') != 0)
-            return KV_ERROR;
-        return is_match_pair(json, "rue", JSON_TRUE);
+        return read_literal(json, "rue", 3, JSON_TRUE);
     case 'T':
-        json->type = JSON_TRUE;
-        if(pushchar(json, '1') != 0)
-            return JSON_ERROR;
-        return is_match_pair(json, "RUE", JSON_TRUE);
+        return read_literal(json, "RUE", 3, JSON_TRUE);
     case '0': // pass through
     case '1': // pass through
     case '2': // pass through
@@ -494,11 +1101,21 @@ static enum kvp_json_type read_value(kvp_iterator* json, int c)
     case '8':
     case '9':
     case '-': // pass through
+        json->type = JSON_NUMBER;
+        // number text in buffer is kept as view, see kvp_get_string
+        if(source_in_memory(&json->source)) {
+            size_t start = json->source.position - 1;
+            json->data.view = NULL;
+            if(read_number(json, c, false) != JSON_NUMBER)
+                return JSON_ERROR;
+            json->data.view = json->source.source.buffer.buffer + start;
+            json->data.view_length = json->source.position - start;
+            return JSON_NUMBER;
+        }
         if(init_string(json) != 0)
             return JSON_ERROR;
-        json->type = JSON_NUMBER;
 
-        return read_number(json, c);
+        return read_number(json, c, true);
 
     default:
         json_error(json, "unexpected byte '%c' in value", c);
@@ -511,92 +1128,673 @@ void print_kvp(kvp_iterator* json)
     printf(" data: %s(%zu), %d ", json->data.string, json->data.string_size, json->type);
 }
 
-enum kvp_json_type kvp_next(kvp_iterator* json)
+// classes of bytes for the transitions of the state machine
+enum kvp_char_class { CC_OTHER, CC_OPEN, CC_CLOSE, CC_COMMA, CC_COLON, CC_EOF, CC_COUNT };
+
+static const unsigned char char_class[256] = {
+    ['{'] = CC_OPEN, ['}'] = CC_CLOSE, [','] = CC_COMMA, [':'] = CC_COLON,
+};
+
+#define KV_ROW(other, open, close, comma, colon, eof) {other, open, close, comma, colon, eof}
+
+// state entered by the structural byte of the class in the state:
+// KV_START - out of object, KV_READSEMI - after key, KV_READEND - after
+// value; KV_READKEY and KV_READVAL mean key or value is read next
+static const unsigned char kv_transition[KV_END + 1][CC_COUNT] = {
+    [0] = KV_ROW(KV_ERROR, KV_ERROR, KV_ERROR, KV_ERROR, KV_ERROR, KV_ERROR),
+    [KV_ERROR] = KV_ROW(KV_ERROR, KV_ERROR, KV_ERROR, KV_ERROR, KV_ERROR, KV_ERROR),
+    [KV_START] = KV_ROW(KV_ERROR, KV_READKEY, KV_ERROR, KV_ERROR, KV_ERROR, KV_END),
+    [KV_READKEY] = KV_ROW(KV_ERROR, KV_ERROR, KV_ERROR, KV_ERROR, KV_ERROR, KV_ERROR),
+    [KV_READSEMI] = KV_ROW(KV_ERROR, KV_ERROR, KV_ERROR, KV_ERROR, KV_READVAL, KV_ERROR),
+    [KV_READVAL] = KV_ROW(KV_ERROR, KV_ERROR, KV_ERROR, KV_ERROR, KV_ERROR, KV_ERROR),
+    [KV_READEND] = KV_ROW(KV_ERROR, KV_ERROR, KV_START, KV_READKEY, KV_ERROR, KV_ERROR),
+    [KV_END] = KV_ROW(KV_ERROR, KV_ERROR, KV_ERROR, KV_ERROR, KV_ERROR, KV_END),
+};
+
+/* Moves the state machine by structural byte c (EOF at the end of text);
+ * returns the state entered, KV_READKEY or KV_READVAL if key or value is
+ * to be read then, KV_ERROR with error set */
+static enum kvp_state_machine_type kv_step(kvp_iterator* json, int c)
 {
+    enum kvp_state_machine_type state = kv_transition[json->state][c == EOF ? CC_EOF : char_class[c]];
+    switch(state) {
+    case KV_READKEY:
+        if(c == ',')
+            json->comas++;
+        json->isKey = true;
+        json->state = KV_READSEMI;
+        break;
+    case KV_READVAL:
+        json->ntokens++;
+        json->isKey = false;
+        json->state = KV_READEND;
+        break;
+    case KV_START:
+        json->comas = 0;
+        json->state = KV_START;
+        break;
+    case KV_ERROR:
+        json_error(json, "%s", c == EOF ? "unexpected end of text" : "invalid parser state");
+        break;
+    default:
+        break;
+    }
+    return state;
+}
 
+/* Reads the next key or value */
+static enum kvp_json_type next_token(kvp_iterator* json)
+{
     if(json->flags & JSON_FLAG_ERROR)
         return JSON_ERROR;
 
-    int c = next_char(json);
-
-    if(c == EOF)
-        return JSON_END;
-
-    int c_next;
-
-    // printf(" js %d",json->type);
-
-    switch(c) {
-
-    case '{':
-        json->figure_brackets++;
-        if(json->figure_brackets != 1) {
-            json_error(json, "%s", "invalid parser state");
+    while(1) {
+        int c = next_char(json);
+        if(c == EOF && json->source.kind == KVP_SOURCE_FD && json->source.source.fd.error != 0) {
+            json_error(json, "read error: %s", strerror(json->source.source.fd.error));
             return JSON_ERROR;
         }
-        json->isKey = true;
-        c_next = next_char(json);
-        // sprintf(" n=%c",c_next);
-
-        enum kvp_json_type r = read_value(json, c_next);
-        // printf("%d", r );
-        // print_kvp(json);
-        return r;
-
-    case ',':
-        json->comas++;
 
-        if(json->figure_brackets != 1 || json->comas != json->semis) {
-            json_error(json, "%s", "invalid parser state");
-            return JSON_ERROR;
+        switch(kv_step(json, c)) {
+        case KV_READKEY:
+        case KV_READVAL: {
+            enum kvp_json_type type = read_value(json, next_char(json));
+            KVP_COUNT(json, tokens[type], 1);
+            KVP_COUNT(json, keys, json->isKey);
+            return type;
         }
-        json->isKey = true;
-        c_next = next_char(json);
-
-        return read_value(json, c_next);
-    case ':':
-        json->semis++;
-        json->ntokens++;
-        json->isKey = false;
-        c_next = next_char(json);
-
-        return read_value(json, c_next);
-    case '}':
-        json->figure_brackets--;
-        if(json->figure_brackets != 0) {
-            json_error(json, "%s", "invalid parser state");
+        case KV_START:
+            continue;
+        case KV_END:
+            return JSON_END;
+        default:
             return JSON_ERROR;
         }
-        json->comas = 0;
-        json->semis = 0;
-        // c_next = next_pair(json);
-
-        return kvp_next(json);
-
-    default:
-        json_error(json, "%s", "invalid parser state");
-        return JSON_ERROR;
     }
-
-    json_error(json, "%s", "invalid parser state");
-    return JSON_ERROR;
 }
 
-void kvp_reset_iterator(kvp_iterator* json)
+/* Sets text of the current data of any type */
+static void data_text(kvp_iterator* json, const char** text, size_t* length)
 {
-    // json->lineno = 0;
-    json->ntokens = 0;
-    json->comas = 0;
-    json->semis = 0;
-    json->figure_brackets = 0;
-    json->type = 0;
-    json->flags &= ~JSON_FLAG_ERROR;
-    json->errmsg[0] = '\0';
+    if(json->data.view != NULL) {
+        *text = json->data.view;
+        *length = json->data.view_length;
+    } else {
+        *text = json->data.string != NULL ? json->data.string : "";
+        *length = json->data.string_fill > 0 ? json->data.string_fill - 1 : 0;
+    }
 }
 
+/* Copies text to the end of *buffer growing it; returns the copy or NULL */
+static char* save_text(kvp_iterator* json, char** buffer, size_t* fill, size_t* size, const char* text, size_t length)
+{
+    if(*fill + length > *size || *buffer == NULL) {
+        size_t n = *size > 0 ? *size * 2 : 256;
+        while(n < *fill + length)
+            n *= 2;
+        char* p = (char*)kvp_realloc(&json->alloc, *buffer, n);
+        if(p == NULL) {
+            json_error(json, "%s", "out of memory");
+            return NULL;
+        }
+        *buffer = p;
+        *size = n;
+    }
+    char* copy = *buffer + *fill;
+    memcpy(copy, text, length);
+    *fill += length;
+    return copy;
+}
+
+/* Moves pointers of pairs into batch buffer moved from old base */
+static void rebase_batch(kvp_pair* pairs, size_t count, uintptr_t old, size_t fill, const char* base)
+{
+    for(size_t i = 0; i < count; i++) {
+        if((uintptr_t)pairs[i].key - old < fill)
+            pairs[i].key = base + ((uintptr_t)pairs[i].key - old);
+        if((uintptr_t)pairs[i].value - old < fill)
+            pairs[i].value = base + ((uintptr_t)pairs[i].value - old);
+    }
+}
+
+/* Does the view point into feed carry, which is rewritten by next pairs */
+static bool view_in_carry(kvp_iterator* json)
+{
+    const char* carry = json->source.source.buffer.carry;
+    return json->source.kind == KVP_SOURCE_FEED && carry != NULL && json->data.view >= carry &&
+        json->data.view < carry + json->source.source.buffer.carry_size;
+}
+
+/* Keeps text of the current data in batch buffer unless it is a view
+ * into the source; pointers of pairs[0..count] are kept valid */
+static const char* batch_text(kvp_iterator* json, kvp_pair* pairs, size_t count, size_t* length)
+{
+    const char* text;
+    data_text(json, &text, length);
+    if(json->data.view != NULL && !view_in_carry(json))
+        return text;
+    uintptr_t old = (uintptr_t)json->data.batch;
+    size_t fill = json->data.batch_fill;
+    char* copy = save_text(json, &json->data.batch, &json->data.batch_fill, &json->data.batch_size, text, *length);
+    if(copy != NULL && (uintptr_t)json->data.batch != old)
+        rebase_batch(pairs, count + 1, old, fill, json->data.batch);
+    return copy;
+}
+
+/* Sets type and parsed scalar of the value */
+static void pair_scalar(kvp_iterator* json, kvp_pair* pair, enum kvp_json_type type)
+{
+    pair->type = type;
+    pair->integer = false;
+    pair->scalar.integer = 0;
+    if(type == JSON_NUMBER) {
+        if(kvp_get_int64(json, &pair->scalar.integer))
+            pair->integer = true;
+        else
+            pair->scalar.real = kvp_get_double(json);
+    } else if(type == JSON_TRUE || type == JSON_FALSE) {
+        pair->scalar.boolean = type == JSON_TRUE;
+    }
+}
+
+/* Reads key and value into pairs[count]; texts which are not views
+ * go to batch buffer if batch, otherwise key goes to key buffer */
+static enum kvp_json_type read_pair_tokens(kvp_iterator* json, kvp_pair* pairs, size_t count, bool batch)
+{
+    kvp_pair* pair = &pairs[count];
+    pair->key = NULL;
+    pair->value = NULL;
+    enum kvp_json_type type = kvp_next(json);
+    if(type == JSON_END || type == JSON_ERROR)
+        return type;
+    if(!json->isKey) {
+        json_error(json, "%s", "value without key");
+        return JSON_ERROR;
+    }
+
+    pair->key_id = json->key_id;
+
+    // key text must outlive reading of the value
+    if(batch) {
+        pair->key = batch_text(json, pairs, count, &pair->key_length);
+    } else {
+        data_text(json, &pair->key, &pair->key_length);
+        if(json->data.view == NULL) {
+            size_t fill = 0;
+            pair->key = save_text(json, &json->data.key, &fill, &json->data.key_size, pair->key, pair->key_length);
+        }
+    }
+    if(pair->key == NULL)
+        return JSON_ERROR;
+
+    type = kvp_next(json);
+    if(type == JSON_ERROR)
+        return JSON_ERROR;
+    if(type == JSON_END || json->isKey) {
+        json_error(json, "%s", "key without value");
+        return JSON_ERROR;
+    }
+    pair_scalar(json, pair, type);
+    if(batch)
+        pair->value = batch_text(json, pairs, count, &pair->value_length);
+    else
+        data_text(json, &pair->value, &pair->value_length);
+    if(pair->value == NULL)
+        return JSON_ERROR;
+    return type;
+}
+
+// parser state at the start of a pair, restored when fed chunk ends in it
+struct pair_snapshot {
+    size_t position;
+    size_t lineno;
+    size_t ntokens;
+    enum kvp_state_machine_type state;
+    int comas;
+    bool isKey;
+#ifdef KVP_STATS
+    kvp_stats stats; /// tokens read again are not counted twice
+#endif
+};
+
+static void save_state(kvp_iterator* json, struct pair_snapshot* state)
+{
+    count_lines(json);
+    state->position = json->source.position;
+    state->lineno = json->lineno;
+    state->ntokens = json->ntokens;
+    state->state = json->state;
+    state->comas = json->comas;
+    state->isKey = json->isKey;
+#ifdef KVP_STATS
+    state->stats = json->stats;
+#endif
+}
+
+static void restore_state(kvp_iterator* json, const struct pair_snapshot* state)
+{
+    json->source.position = state->position;
+    json->source.line_position = state->position;
+    json->lineno = state->lineno;
+    json->ntokens = state->ntokens;
+    json->state = state->state;
+    json->comas = state->comas;
+    json->isKey = state->isKey;
+#ifdef KVP_STATS
+    json->stats = state->stats;
+#endif
+    json->flags &= ~JSON_FLAG_ERROR;
+    json->errmsg[0] = '\0';
+}
+
+/* Reads pair as read_pair_tokens; in feed mode a pair cut by the end of
+ * chunk is read again with more input, JSON_END asks for next chunk */
+static enum kvp_json_type read_pair(kvp_iterator* json, kvp_pair* pairs, size_t count, bool batch)
+{
+    if(json->source.kind != KVP_SOURCE_FEED)
+        return read_pair_tokens(json, pairs, count, batch);
+
+    struct json_source* source = &json->source;
+    struct pair_snapshot state;
+    save_state(json, &state);
+    while(1) {
+        source->source.buffer.eof = false;
+        enum kvp_json_type type = read_pair_tokens(json, pairs, count, batch);
+        if(!source->source.buffer.eof || source->source.buffer.final) {
+            // pair completed in the carry: go on in the chunk after it
+            size_t left = source->source.buffer.carry_fill - source->position;
+            if(type != JSON_ERROR && type != JSON_END && source->source.buffer.buffer == source->source.buffer.carry &&
+                left <= source->source.buffer.carry_chunk) {
+                count_lines(json);
+                source->source.buffer.buffer = source->source.buffer.chunk;
+                source->source.buffer.length = source->source.buffer.chunk_length;
+                source->position = source->source.buffer.chunk_offset - left;
+                source->line_position = source->position;
+                source->source.buffer.chunk_offset = source->source.buffer.chunk_length;
+                source->source.buffer.carry_fill = 0;
+                source->source.buffer.carry_chunk = 0;
+            }
+            return type;
+        }
+
+        // input ended inside the pair: keep its text and read it again
+        restore_state(json, &state);
+        if(source->source.buffer.buffer == source->source.buffer.chunk) {
+            source->source.buffer.carry_fill = 0;
+            source->source.buffer.carry_chunk = 0;
+            source->source.buffer.chunk_offset = state.position;
+            if(!feed_carry(json, source->source.buffer.chunk_length - state.position))
+                return JSON_ERROR;
+        } else {
+            size_t n = source->source.buffer.carry_fill - state.position;
+            if(n > 0)
+                memmove(source->source.buffer.carry, source->source.buffer.carry + state.position, n);
+            source->source.buffer.carry_fill = n;
+            source->source.buffer.length = n;
+            if(source->source.buffer.carry_chunk > n)
+                source->source.buffer.carry_chunk = n;
+        }
+        source->position = 0;
+        source->line_position = 0;
+        state.position = 0;
+        if(source->source.buffer.chunk_offset == source->source.buffer.chunk_length) {
+            source->source.buffer.unread = false;
+            return JSON_END;
+        }
+        size_t more = source->source.buffer.carry_fill > 4096 ? source->source.buffer.carry_fill : 4096;
+        if(!feed_carry(json, more))
+            return JSON_ERROR;
+    }
+}
+
+enum kvp_json_type kvp_next_pair(kvp_iterator* json, kvp_pair* pair)
+{
+    enum kvp_json_type type = read_pair(json, pair, 0, false);
+    if(type == JSON_END || type == JSON_ERROR)
+        json->type = type;
+    return type;
+}
+
+size_t kvp_next_batch(kvp_iterator* json, kvp_pair* pairs, size_t count)
+{
+    size_t n = 0;
+    json->data.batch_fill = 0;
+    while(n < count) {
+        enum kvp_json_type type = read_pair(json, pairs, n, true);
+        if(type == JSON_END || type == JSON_ERROR) {
+            json->type = type;
+            break;
+        }
+        n++;
+    }
+    return n;
+}
+
+/* Skips rest of string after the opening quote: only quotes and escapes
+ * are looked at, the text is not validated */
+static int skip_string(kvp_iterator* json)
+{
+    bool escaped = false;
+    while(1) {
+        const char* window;
+        size_t n = source_window(&json->source, &window);
+        if(n > 0) {
+            size_t i = kvp_find_quote(window, n, &escaped);
+            source_skip(&json->source, i < n ? i + 1 : n);
+            if(i < n)
+                return 0;
+            continue;
+        }
+
+        int c = source_get(&json->source);
+        if(c == EOF) {
+            json_error(json, "%s", "unterminated string literal");
+            return -1;
+        } else if(escaped) {
+            escaped = false;
+        } else if(c == '"') {
+            return 0;
+        } else if(c == '\\') {
+            escaped = true;
+        }
+    }
+}
+
+/* Does byte end number or literal which is skipped */
+static bool is_delimiter(int c)
+{
+    return c == ',' || c == '}' || c == ':' || c == '"' || c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+/* Skips value after ':' of the key which is not read */
+static int skip_value(kvp_iterator* json)
+{
+    if(kv_step(json, next_char(json)) != KV_READVAL)
+        return -1;
+    json->ntokens++;
+
+    int c = next_char(json);
+    switch(c) {
+    case EOF:
+        json_error(json, "%s", "unexpected end of text");
+        return -1;
+    case '"':
+        return skip_string(json);
+    case '{':
+    case '[':
+    case '}':
+    case ',':
+    case ':':
+        json_error(json, "unexpected byte '%c' in value", c);
+        return -1;
+    default:
+        // number or literal lasts up to delimiter
+        while(1) {
+            const char* window;
+            size_t n = source_window(&json->source, &window);
+            if(n == 0)
+                break;
+            size_t i = 0;
+            while(i < n && !is_delimiter((unsigned char)window[i]))
+                i++;
+            source_skip(&json->source, i);
+            if(i < n)
+                return 0;
+        }
+        while((c = source_peek(&json->source)) != EOF && !is_delimiter(c))
+            source_get(&json->source);
+        return 0;
+    }
+}
+
+/* Makes room for count keys with texts of length bytes in shape */
+static bool shape_reserve(kvp_iterator* json, struct kvp_shape* shape, size_t count, size_t length)
+{
+    if(count > shape->size) {
+        size_t n = 2 * shape->size > count ? 2 * shape->size : count + 16;
+        struct kvp_shape_key* keys = kvp_realloc(&json->alloc, shape->keys, n * sizeof(*keys));
+        if(keys == NULL)
+            return false;
+        shape->keys = keys;
+        shape->size = n;
+    }
+    if(length > shape->text_size) {
+        size_t n = 2 * shape->text_size > length ? 2 * shape->text_size : length + 256;
+        char* text = kvp_realloc(&json->alloc, shape->text, n);
+        if(text == NULL)
+            return false;
+        shape->text = text;
+        shape->text_size = n;
+    }
+    return true;
+}
+
+/* Length of texts of the first count keys of shape */
+static size_t shape_text_length(const struct kvp_shape* shape, size_t count)
+{
+    return count > 0 ? shape->keys[count - 1].offset + shape->keys[count - 1].length : 0;
+}
+
+/* Is key at index of shape the text */
+static bool shape_key_equal(const struct kvp_shape* shape, size_t index, const char* text, size_t length)
+{
+    if(index >= shape->count)
+        return false;
+    const struct kvp_shape_key* key = &shape->keys[index];
+    return key->length == length && (length == 0 || memcmp(shape->text + key->offset, text, length) == 0);
+}
+
+/* Are the first count keys of shapes a and b the same */
+static bool shape_same_prefix(const struct kvp_shape* a, const struct kvp_shape* b, size_t count)
+{
+    if(a->count < count || b->count < count)
+        return false;
+    size_t length = shape_text_length(a, count);
+    if(length != shape_text_length(b, count) || (length > 0 && memcmp(a->text, b->text, length) != 0))
+        return false;
+    for(size_t i = 0; i < count; i++) {
+        if(a->keys[i].length != b->keys[i].length)
+            return false;
+    }
+    return true;
+}
+
+/* Finds shape predicting key at index of the object: the current one or
+ * another one with the same keys before it; returns the key or NULL */
+static const struct kvp_shape_key* shape_predict(kvp_iterator* json, size_t index, const char* text, size_t length)
+{
+    struct kvp_shapes* shapes = &json->shapes;
+    struct kvp_shape* current = &shapes->shape[shapes->current];
+    if(index == 0)
+        shapes->objects++;
+    if(!shape_key_equal(current, index, text, length)) {
+        size_t i = 0;
+        while(i < KVP_SHAPE_CACHE && (i == shapes->current || !shape_key_equal(&shapes->shape[i], index, text, length) ||
+                                      !shape_same_prefix(&shapes->shape[i], current, index)))
+            i++;
+        if(i == KVP_SHAPE_CACHE)
+            return NULL;
+        shapes->current = i;
+        current = &shapes->shape[i];
+    }
+    current->used = shapes->objects;
+    return &current->keys[index];
+}
+
+/* Remembers key at index of the object after the current shape failed
+ * to predict it: the shape is extended, or a copy of its keys before
+ * index or a new shape (least recently used one is replaced) gets it */
+static void shape_record(kvp_iterator* json, size_t index, const char* text, size_t length, bool wanted)
+{
+    struct kvp_shapes* shapes = &json->shapes;
+    struct kvp_shape* current = &shapes->shape[shapes->current];
+    if(index > current->count)
+        return;
+
+    if(index == 0 || index < current->count) {
+        size_t victim = shapes->current == 0 ? 1 : 0;
+        for(size_t i = 0; i < KVP_SHAPE_CACHE; i++) {
+            if(i != shapes->current && shapes->shape[i].used < shapes->shape[victim].used)
+                victim = i;
+        }
+        struct kvp_shape* shape = &shapes->shape[victim];
+        size_t prefix = shape_text_length(current, index);
+        if(!shape_reserve(json, shape, index, prefix))
+            return;
+        if(index > 0) {
+            memcpy(shape->keys, current->keys, index * sizeof(*shape->keys));
+            if(prefix > 0)
+                memcpy(shape->text, current->text, prefix);
+        }
+        shape->count = index;
+        shapes->current = victim;
+        current = shape;
+    }
+
+    size_t offset = shape_text_length(current, index);
+    if(!shape_reserve(json, current, index + 1, offset + length))
+        return;
+    struct kvp_shape_key* key = &current->keys[index];
+    key->offset = offset;
+    key->length = length;
+    key->id = json->key_id;
+    key->wanted = wanted;
+    if(length > 0)
+        memcpy(current->text + offset, text, length);
+    current->count = index + 1;
+    current->used = shapes->objects;
+}
+
+/* Looks the key just read up in the key filter and interned keys: the
+ * same key as at this position of the last object is known already,
+ * other one is hashed once for both tables; returns true if the key
+ * is wanted, false if it is filtered out or on error */
+static bool key_lookup(kvp_iterator* json)
+{
+    const char* text;
+    size_t length;
+    data_text(json, &text, &length);
+
+    size_t index = (size_t)json->comas;
+    const struct kvp_shape_key* key = shape_predict(json, index, text, length);
+    if(key != NULL) {
+        json->shapes.hits++;
+        if(key->wanted)
+            json->key_id = key->id;
+        return key->wanted;
+    }
+    json->shapes.misses++;
+
+    uint64_t hash = ht_hash(text, length);
+    bool wanted = json->filter == NULL || ht_get_hashed(json->filter, text, length, hash) != NULL;
+    if(wanted && json->keys != NULL) {
+        bool inserted;
+        void** id = ht_upsert(json->keys, text, length, hash, &inserted);
+        if(id == NULL) {
+            json_error(json, "%s", "out of memory");
+            return false;
+        }
+        if(inserted)
+            *id = (void*)(uintptr_t)ht_length(json->keys);
+        json->key_id = (size_t)(uintptr_t)*id;
+    }
+    shape_record(json, index, text, length, wanted);
+    return wanted;
+}
+
+enum kvp_json_type kvp_next(kvp_iterator* json)
+{
+    enum kvp_json_type type = next_token(json);
+    while((json->filter != NULL || json->keys != NULL) && json->isKey && type != JSON_END && type != JSON_ERROR &&
+          !key_lookup(json)) {
+        if(json->flags & JSON_FLAG_ERROR)
+            return JSON_ERROR;
+        if(skip_value(json) != 0)
+            return JSON_ERROR;
+        type = next_token(json);
+    }
+    return type;
+}
+
+/* Forgets shapes predicting keys of other tables */
+static void shapes_clear(kvp_iterator* json)
+{
+    for(size_t i = 0; i < KVP_SHAPE_CACHE; i++)
+        json->shapes.shape[i].count = 0;
+}
+
+void kvp_set_key_filter(kvp_iterator* json, struct kvphash_table* keys)
+{
+    json->filter = keys;
+    shapes_clear(json);
+}
+
+void kvp_set_key_interning(kvp_iterator* json, struct kvphash_table* keys)
+{
+    json->keys = keys;
+    json->key_id = 0;
+    shapes_clear(json);
+}
+
+size_t kvp_get_key_id(kvp_iterator* json)
+{
+    return json->key_id;
+}
+
+void kvp_get_shape_stats(kvp_iterator* json, size_t* hits, size_t* misses)
+{
+    *hits = json->shapes.hits;
+    *misses = json->shapes.misses;
+}
+
+bool kvp_get_stats(kvp_iterator* json, kvp_stats* stats)
+{
+#ifdef KVP_STATS
+    *stats = json->stats;
+    // bytes and size are known without counting
+    if(json->source.kind != KVP_SOURCE_FEED) {
+        stats->bytes = json->source.position;
+        if(source_in_memory(&json->source) && stats->bytes > json->source.source.buffer.length)
+            stats->bytes = json->source.source.buffer.length;
+    }
+    stats->peak_string_size = json->data.string_size;
+    return true;
+#else
+    (void)json;
+    memset(stats, 0, sizeof(*stats));
+    return false;
+#endif
+}
+
+void kvp_reset_iterator(kvp_iterator* json)
+{
+    // json->lineno = 0;
+    json->ntokens = 0;
+    json->comas = 0;
+    json->state = KV_START;
+    json->type = 0;
+    json->flags &= ~JSON_FLAG_ERROR;
+    json->errmsg[0] = '\0';
+}
+
+
+/* Copies data kept as view into data.string */
+static int materialize_view(kvp_iterator* json)
+{
+    const char* view = json->data.view;
+    size_t length = json->data.view_length;
+    if(init_string(json) != 0 || pushchars(json, view, length) != 0 || pushchar(json, '\0') != 0)
+        return -1;
+    return 0;
+}
 
 const char* kvp_get_string(kvp_iterator* json, size_t* length)
 {
+    if(json->data.view != NULL && materialize_view(json) != 0) {
+        if(length != NULL)
+            *length = 0;
+        return "";
+    }
     if(length != NULL)
         *length = json->data.string_fill;
     if(json->data.string == NULL)
@@ -605,9 +1803,26 @@ const char* kvp_get_string(kvp_iterator* json, size_t* length)
         return json->data.string;
 }
 
-size_t kvp_save_string(kvp_iterator* json, char* buf)
+bool kvp_get_string_view(kvp_iterator* json, const char** ptr, size_t* length)
 {
+    if(json->type != JSON_STRING && json->type != JSON_NUMBER) {
+        *ptr = NULL;
+        *length = 0;
+        return false;
+    }
+    if(json->data.view != NULL) {
+        *ptr = json->data.view;
+        *length = json->data.view_length;
+    } else {
+        *ptr = json->data.string != NULL ? json->data.string : "";
+        *length = json->data.string_fill > 0 ? json->data.string_fill - 1 : 0;
+    }
+    return true;
+}
 
+size_t kvp_save_string(kvp_iterator* json, char* buf)
+{
+    kvp_get_string(json, NULL);
     if(json->data.string == NULL) {
         strcpy(buf, "");
         return 0;
@@ -619,16 +1834,124 @@ size_t kvp_save_string(kvp_iterator* json, char* buf)
 
 double kvp_get_number(kvp_iterator* json)
 {
-    char* p = json->data.string;
-    return p == NULL ? 0 : strtod(p, NULL);
+    return kvp_get_double(json);
 }
 
 int kvp_get_int(kvp_iterator* json)
 {
-    char* p = json->data.string;
+    int64_t value;
+    if(kvp_get_int64(json, &value) && value >= INT_MIN && value <= INT_MAX)
+        return (int)value;
+    const char* p = kvp_get_string(json, NULL);
     return p == NULL ? 0 : strtol(p, (char**)NULL, 10);
 }
 
+bool kvp_is_integer(kvp_iterator* json)
+{
+    return json->type == JSON_NUMBER && json->data.number.integer;
+}
+
+bool kvp_get_uint64(kvp_iterator* json, uint64_t* value)
+{
+    const struct kvp_number* num = &json->data.number;
+    if(!kvp_is_integer(json) || num->truncated || (num->negative && num->mantissa != 0))
+        return false;
+    *value = num->mantissa;
+    return true;
+}
+
+bool kvp_get_int64(kvp_iterator* json, int64_t* value)
+{
+    const struct kvp_number* num = &json->data.number;
+    if(!kvp_is_integer(json) || num->truncated)
+        return false;
+    if(num->negative) {
+        if(num->mantissa > (uint64_t)INT64_MAX + 1)
+            return false;
+        *value = num->mantissa == (uint64_t)INT64_MAX + 1 ? INT64_MIN : -(int64_t)num->mantissa;
+    } else {
+        if(num->mantissa > (uint64_t)INT64_MAX)
+            return false;
+        *value = (int64_t)num->mantissa;
+    }
+    return true;
+}
+
+#ifdef _WIN32
+typedef _locale_t kvp_locale;
+#define kvp_new_c_locale() _create_locale(LC_NUMERIC, "C")
+#define kvp_free_locale(locale) _free_locale(locale)
+#define kvp_strtod_l(p, locale) _strtod_l(p, NULL, locale)
+#define kvp_set_once(ptr, value) (_InterlockedCompareExchangePointer((void* volatile*)(ptr), value, NULL) == NULL)
+#define kvp_load_once(ptr) ((kvp_locale)_InterlockedCompareExchangePointer((void* volatile*)(ptr), NULL, NULL))
+#else
+typedef locale_t kvp_locale;
+#define kvp_new_c_locale() newlocale(LC_NUMERIC_MASK, "C", (locale_t)0)
+#define kvp_free_locale(locale) freelocale(locale)
+#define kvp_strtod_l(p, locale) strtod_l(p, NULL, locale)
+#define kvp_set_once(ptr, value) \
+    __atomic_compare_exchange_n(ptr, &(kvp_locale){ (kvp_locale)0 }, value, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#define kvp_load_once(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#endif
+
+/* strtod in C locale: JSON numbers have '.' whatever setlocale chose */
+static double json_strtod(const char* p)
+{
+    static kvp_locale c_locale;
+    kvp_locale locale = kvp_load_once(&c_locale);
+    if(!locale) {
+        // created once for all iterators; a thread losing the race frees its copy
+        locale = kvp_new_c_locale();
+        if(!locale)
+            return strtod(p, NULL);
+        if(!kvp_set_once(&c_locale, locale)) {
+            kvp_free_locale(locale);
+            locale = kvp_load_once(&c_locale);
+        }
+    }
+    return kvp_strtod_l(p, locale);
+}
+
+double kvp_get_double(kvp_iterator* json)
+{
+    if(json->type != JSON_NUMBER) {
+        // number text of a string value, as kvp_get_int reads it
+        const char* p = kvp_get_string(json, NULL);
+        return p == NULL ? 0 : json_strtod(p);
+    }
+
+    const struct kvp_number* num = &json->data.number;
+    if(num->mantissa == 0 && !num->truncated)
+        return num->negative ? -0.0 : 0.0;
+
+#if FLT_EVAL_METHOD == 0
+    // Clinger's fast path: mantissa and power of ten are exact doubles,
+    // so one correctly rounded multiplication or division gives the result
+    static const double pow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13,
+        1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+    const uint64_t max_exact = (uint64_t)1 << 53;
+    if(!num->truncated && num->mantissa <= max_exact) {
+        uint64_t m = num->mantissa;
+        int e = num->exponent;
+        // move surplus power into mantissa while it stays exact: 12e30
+        while(e > 22 && m <= max_exact / 10) {
+            m *= 10;
+            e--;
+        }
+        double d = (double)m;
+        if(e >= 0 && e <= 22) {
+            d *= pow10[e];
+            return num->negative ? -d : d;
+        } else if(e < 0 && e >= -22) {
+            d /= pow10[-e];
+            return num->negative ? -d : d;
+        }
+    }
+#endif
+    // hard cases: long mantissa or large exponent
+    return json_strtod(kvp_get_string(json, NULL));
+}
+
 bool kvp_get_value(kvp_iterator* json, char* buf, size_t* length)
 {
 
@@ -670,9 +1993,49 @@ const char* kvp_get_error(kvp_iterator* json)
     return json->errmsg;
 }
 
+/* Is the byte read last a newline which failed; it belongs to its line */
+static bool failed_on_newline(kvp_iterator* json)
+{
+    struct json_source* source = &json->source;
+    if(!(json->flags & JSON_FLAG_ERROR))
+        return false;
+    if(source->kind == KVP_SOURCE_FEED && source->source.buffer.eof)
+        return false; // failed on the end of input
+    if(source_in_memory(source))
+        return source->position > 0 && source->position <= source->source.buffer.length &&
+               source->source.buffer.buffer[source->position - 1] == '\n';
+    if(source->kind == KVP_SOURCE_FD)
+        return source->source.fd.offset > 0 && source->source.fd.block[source->source.fd.offset - 1] == '\n';
+    return false;
+}
+
 size_t kvp_get_lineno(kvp_iterator* json)
 {
-    return json->lineno;
+    count_lines(json);
+    return failed_on_newline(json) ? json->lineno - 1 : json->lineno;
+}
+
+size_t kvp_get_column(kvp_iterator* json)
+{
+    struct json_source* source = &json->source;
+    const char* bytes;
+    size_t n;
+    if(source->kind == KVP_SOURCE_BUFFER || source->kind == KVP_SOURCE_MMAP) {
+        bytes = source->source.buffer.buffer;
+        n = source->position < source->source.buffer.length ? source->position : source->source.buffer.length;
+    } else if(source->kind == KVP_SOURCE_FD) {
+        bytes = source->source.fd.block;
+        n = source->source.fd.offset;
+    } else {
+        return 0;
+    }
+    for(size_t i = failed_on_newline(json) ? n - 1 : n; i > 0; i--) {
+        if(bytes[i - 1] == '\n')
+            return n - i;
+    }
+    if(source->kind == KVP_SOURCE_FD)
+        return source->position - source->source.fd.offset + n - source->source.fd.line_start;
+    return n;
 }
 
 void kvp_set_allocator(kvp_iterator* json, kvp_allocator* a)
@@ -690,5 +2053,296 @@ void kvp_set_streaming(kvp_iterator* json, bool streaming)
 
 void kvp_close(kvp_iterator* json)
 {
-    json->alloc.free(json->data.string);
+    kvp_free(&json->alloc, json->data.string);
+    kvp_free(&json->alloc, json->data.key);
+    kvp_free(&json->alloc, json->data.batch);
+    for(size_t i = 0; i < KVP_SHAPE_CACHE; i++) {
+        kvp_free(&json->alloc, json->shapes.shape[i].keys);
+        kvp_free(&json->alloc, json->shapes.shape[i].text);
+    }
+    if(json->source.kind == KVP_SOURCE_FEED)
+        kvp_free(&json->alloc, json->source.source.buffer.carry);
+    if(json->source.kind == KVP_SOURCE_FD)
+        kvp_free(&json->alloc, json->source.source.fd.block);
+#ifndef _WIN32
+    if(json->source.kind == KVP_SOURCE_MMAP && json->source.source.buffer.map != NULL)
+        munmap(json->source.source.buffer.map, json->source.source.buffer.map_length);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void kvp_tape_init(kvp_tape* tape)
+{
+    tape->entries = NULL;
+    tape->count = 0;
+    tape->capacity = 0;
+    tape->buffer = NULL;
+    tape->strings = NULL;
+    tape->strings_fill = 0;
+    tape->strings_size = 0;
+    tape->index = NULL;
+    tape->index_count = 0;
+    tape->index_capacity = 0;
+
+    tape->alloc.malloc = malloc;
+    tape->alloc.realloc = realloc;
+    tape->alloc.free = free;
+    tape->alloc.user = NULL;
+    tape->alloc.malloc_user = NULL;
+    tape->alloc.realloc_user = NULL;
+    tape->alloc.free_user = NULL;
+}
+
+void kvp_tape_set_allocator(kvp_tape* tape, kvp_allocator* a)
+{
+    tape->alloc = *a;
+}
+
+void kvp_tape_close(kvp_tape* tape)
+{
+    kvp_free(&tape->alloc, tape->entries);
+    kvp_free(&tape->alloc, tape->strings);
+    kvp_free(&tape->alloc, tape->index);
+    kvp_tape_init(tape);
+}
+
+/* Grows array *items of *capacity elements of size bytes to hold needed ones */
+static int tape_reserve(kvp_tape* tape, void** items, size_t* capacity, size_t size, size_t needed)
+{
+    if(needed <= *capacity)
+        return 0;
+    size_t n = *capacity > 0 ? *capacity * 2 : 256;
+    while(n < needed)
+        n *= 2;
+    void* p = kvp_realloc(&tape->alloc, *items, n * size);
+    if(p == NULL)
+        return -1;
+    *items = p;
+    *capacity = n;
+    return 0;
+}
+
+/* Stage one: positions of quotes and {}:, outside strings in the buffer */
+static int tape_index(kvp_tape* tape, const char* buffer, size_t length)
+{
+    kvp_structural_state state = { 0, 0 };
+    char tail[64];
+
+    tape->index_count = 0;
+    if(tape_reserve(tape, (void**)&tape->index, &tape->index_capacity, sizeof(size_t), length / 8 + 64) != 0)
+        return -1;
+    for(size_t base = 0; base < length; base += 64) {
+        const char* block = buffer + base;
+        if(length - base < 64) {
+            memset(tail, ' ', sizeof(tail));
+            memcpy(tail, block, length - base);
+            block = tail;
+        }
+        uint64_t mask = kvp_structural_mask64(block, &state);
+        if(mask == 0)
+            continue;
+        if(tape_reserve(tape, (void**)&tape->index, &tape->index_capacity, sizeof(size_t), tape->index_count + 64) != 0)
+            return -1;
+        size_t* out = tape->index + tape->index_count;
+        while(mask != 0) {
+            *out++ = base + kvp_ctz64(mask);
+            mask &= mask - 1;
+        }
+        tape->index_count = (size_t)(out - tape->index);
+    }
+    return 0;
+}
+
+/* Appends entry for the value read by the iterator, start is its first byte */
+static int tape_push(kvp_iterator* json, kvp_tape* tape, size_t start, bool key)
+{
+    if(tape_reserve(tape, (void**)&tape->entries, &tape->capacity, sizeof(kvp_tape_entry), tape->count + 1) != 0) {
+        json_error(json, "%s", "out of memory");
+        return -1;
+    }
+    kvp_tape_entry* e = &tape->entries[tape->count++];
+    e->type = json->type;
+    e->flags = key ? KVP_TAPE_KEY : 0;
+    if(json->type != JSON_STRING && json->type != JSON_NUMBER) {
+        e->offset = start;
+        e->length = json->source.position - start;
+    } else if(json->data.view != NULL) {
+        e->offset = (size_t)(json->data.view - tape->buffer);
+        e->length = json->data.view_length;
+    } else {
+        // unescaped text is kept zero terminated in tape strings
+        size_t n = json->data.string_fill;
+        if(tape_reserve(tape, (void**)&tape->strings, &tape->strings_size, 1, tape->strings_fill + n) != 0) {
+            json_error(json, "%s", "out of memory");
+            return -1;
+        }
+        memcpy(tape->strings + tape->strings_fill, json->data.string, n);
+        e->flags |= KVP_TAPE_ESCAPED;
+        e->offset = tape->strings_fill;
+        e->length = n - 1;
+        tape->strings_fill += n;
+    }
+    return 0;
+}
+
+/* Stage two for one key or value: reads it after the structural byte at
+ * source position, *i is the next index entry */
+static int tape_value(kvp_iterator* json, kvp_tape* tape, size_t* i, bool key)
+{
+    const char* buffer = tape->buffer;
+    size_t length = json->source.source.buffer.length;
+    size_t next = *i < tape->index_count ? tape->index[*i] : length;
+    size_t from = json->source.position;
+    size_t start = from + kvp_skip_space(buffer + from, next - from, NULL);
+    int c = start < length ? (unsigned char)buffer[start] : EOF;
+    enum kvp_json_type type;
+
+    if(c == '"' && start == next) {
+        json->ntokens++;
+        json->type = JSON_STRING;
+        (*i)++;
+        type = JSON_STRING;
+        // closing quote is the next index entry, plain run is kept as view
+        const char* text = buffer + start + 1;
+        size_t n = *i < tape->index_count ? tape->index[*i] - start - 1 : 0;
+        if(*i < tape->index_count && kvp_scan_string(text, n) == n && kvp_validate_utf8(text, n)) {
+            json->data.view = text;
+            json->data.view_length = n;
+            json->source.position = tape->index[(*i)++] + 1;
+        } else {
+            json->source.position = start + 1;
+            type = read_string(json);
+            while(*i < tape->index_count && tape->index[*i] < json->source.position)
+                (*i)++;
+        }
+    } else {
+        json->source.position = c != EOF ? start + 1 : start;
+        type = read_value(json, c);
+    }
+    if(type == JSON_ERROR) {
+        /* keep the error of the scanner, as kvp_next reports it */
+        if(!(json->flags & JSON_FLAG_ERROR))
+            json_error(json, "unexpected byte '%c' in value", c);
+        return -1;
+    }
+    return tape_push(json, tape, start, key);
+}
+
+int kvp_parse_tape(kvp_iterator* json, kvp_tape* tape)
+{
+    tape->count = 0;
+    tape->strings_fill = 0;
+    tape->buffer = NULL;
+    if(json->source.kind != KVP_SOURCE_BUFFER && json->source.kind != KVP_SOURCE_MMAP) {
+        json_error(json, "%s", "tape needs buffer or mmap source");
+        return -1;
+    }
+
+    const char* buffer = json->source.source.buffer.buffer;
+    size_t length = json->source.source.buffer.length;
+    tape->buffer = buffer;
+
+    kvp_reset_iterator(json);
+    json->source.position = 0;
+    reset_lines(json);
+    if(tape_index(tape, buffer, length) != 0) {
+        json_error(json, "%s", "out of memory");
+        return -1;
+    }
+
+    // stage two: state machine of kvp_next over the structural bytes
+    size_t i = 0;
+    size_t end = 0; // end of the last token
+    while(1) {
+        size_t next = i < tape->index_count ? tape->index[i] : length;
+        size_t gap = kvp_skip_space(buffer + end, next - end, NULL);
+        if(end + gap < next) {
+            json->source.position = end + gap + 1;
+            json_error(json, "%s", "invalid parser state");
+            return -1;
+        }
+        enum kvp_state_machine_type state = kv_step(json, i < tape->index_count ? buffer[tape->index[i++]] : EOF);
+        json->source.position = next + 1;
+        if(state == KV_END)
+            break;
+        if(state == KV_ERROR)
+            return -1;
+        if(state == KV_START) {
+            end = next + 1;
+            continue;
+        }
+        if(tape_value(json, tape, &i, state == KV_READKEY) != 0)
+            return -1;
+        end = json->source.position;
+    }
+    json->source.position = length;
+    json->type = JSON_END;
+    return 0;
+}
+
+size_t kvp_tape_size(const kvp_tape* tape)
+{
+    return tape->count;
+}
+
+enum kvp_json_type kvp_tape_get(const kvp_tape* tape, size_t i, const char** ptr, size_t* length)
+{
+    if(i >= tape->count) {
+        *ptr = "";
+        *length = 0;
+        return JSON_END;
+    }
+    const kvp_tape_entry* e = &tape->entries[i];
+    if(e->type == JSON_STRING || e->type == JSON_NUMBER) {
+        *ptr = (e->flags & KVP_TAPE_ESCAPED) ? tape->strings + e->offset : tape->buffer + e->offset;
+        *length = e->length;
+    } else {
+        // as kvp_get_string of true/false/null
+        *ptr = e->type == JSON_TRUE ? "1" : "0";
+        *length = 1;
+    }
+    return e->type;
+}
+
+bool kvp_tape_is_key(const kvp_tape* tape, size_t i)
+{
+    return i < tape->count && (tape->entries[i].flags & KVP_TAPE_KEY);
+}
+
+/* Scans number entry i of the tape with iterator over its text,
+ * the iterator is to be closed if true is returned */
+static bool tape_number(const kvp_tape* tape, size_t i, kvp_iterator* json)
+{
+    const char* text;
+    size_t length;
+    if(kvp_tape_get(tape, i, &text, &length) != JSON_NUMBER)
+        return false;
+    kvp_open_buffer(json, text, length);
+    json->source.position = 1;
+    if(read_value(json, (unsigned char)text[0]) != JSON_NUMBER) {
+        kvp_close(json);
+        return false;
+    }
+    return true;
+}
+
+bool kvp_tape_get_int64(const kvp_tape* tape, size_t i, int64_t* value)
+{
+    kvp_iterator json;
+    if(!tape_number(tape, i, &json))
+        return false;
+    bool ok = kvp_get_int64(&json, value);
+    kvp_close(&json);
+    return ok;
+}
+
+double kvp_tape_get_double(const kvp_tape* tape, size_t i)
+{
+    kvp_iterator json;
+    if(!tape_number(tape, i, &json))
+        return 0.0;
+    double d = kvp_get_double(&json);
+    kvp_close(&json);
+    return d;
 }
@@ -37,26 +37,70 @@ extern "C" {
 
 #include "utilits.h"
 
+#include <stdint.h>
+
+struct kvphash_table;
+
 
 /*
- * struct to keep allocator in function form
+ * struct to keep allocator in function form;
+ * if malloc_user is set the *_user hooks are called with user
+ * context instead of malloc/realloc/free (see kvp_arena_allocator)
  * */
 typedef struct kvp_allocator {
     void *(*malloc)(size_t);
     void *(*realloc)(void *, size_t);
     void (*free)(void *);
+
+    void *user; /// context of the hooks below
+    void *(*malloc_user)(void *user, size_t);
+    void *(*realloc_user)(void *user, void *, size_t);
+    void (*free_user)(void *user, void *);
 }kvp_allocator;
 
+static inline void *kvp_malloc(const kvp_allocator *a, size_t size)
+{
+    return a->malloc_user != NULL ? a->malloc_user(a->user, size) : a->malloc(size);
+}
+
+static inline void *kvp_realloc(const kvp_allocator *a, void *ptr, size_t size)
+{
+    return a->malloc_user != NULL ? a->realloc_user(a->user, ptr, size) : a->realloc(ptr, size);
+}
+
+static inline void kvp_free(const kvp_allocator *a, void *ptr)
+{
+    if(a->malloc_user != NULL)
+        a->free_user(a->user, ptr);
+    else
+        a->free(ptr);
+}
+
 /* 
  * function type for communication with streams
  * */
 typedef int (*json_user_io)(void *user);
 
+/*
+ * default size of the block read by the fd source
+ * */
+#define KVP_FD_BLOCK_SIZE (256 * 1024)
+
+// kind of the source under the iterator
+enum kvp_source_kind {
+    KVP_SOURCE_BUFFER = 1,
+    KVP_SOURCE_STREAM,
+    KVP_SOURCE_FD,
+    KVP_SOURCE_USER,
+    KVP_SOURCE_MMAP,
+    KVP_SOURCE_FEED,
+};
+
 
 /////////////////////////////////////////
 
 
-// types of state machine
+// states of state machine (see kv_transition)
 enum kvp_state_machine_type {
     KV_ERROR = 1, KV_START,
     KV_READKEY, KV_READSEMI,
@@ -77,9 +121,22 @@ enum kvp_json_type{
     JSON_END,
 };
 
+/*
+ * value of the number accumulated while it is scanned:
+ * mantissa * 10^exponent
+ * */
+struct kvp_number {
+    uint64_t mantissa; /// decimal digits without point
+    int exponent; /// power of ten applied to mantissa
+    int exponent_value; /// digits after e/E
+    bool negative;
+    bool integer; /// no fraction or exponent part
+    bool truncated; /// digits did not fit into mantissa
+};
+
 /*
  * JSON sorce struct:
- * source is either FILE / text buffer/ user input;
+ * source is either FILE / file descriptor / text buffer (or mapped file)/ user input;
  * keeps the postion in source.
  * Methods:
  * - get : receives next char
@@ -89,15 +146,42 @@ typedef struct json_source {
     int (*get)(struct json_source *);
     int (*peek)(struct json_source *);
     
+    enum kvp_source_kind kind;
     size_t position;
+    size_t line_position; /// newlines before it are counted (in memory sources)
+    size_t lines; /// newlines of fd blocks read, not added to lineno yet
     
     union {
         struct {
             FILE *stream;
         } stream;
         struct {
-            const char *buffer;
+            int fd;
+            char *block; /// allocated on first read with *alloc
+            size_t block_size;
+            size_t fill; /// bytes read into block
+            size_t offset; /// next byte in block
+            int error; /// errno of the failed read, 0 if none
+            size_t line_start; /// position of the line start before the block
+            struct kvp_allocator *alloc;
+        } fd;
+        struct {
+            const char *buffer; /// (feed mode: window over chunk or carry)
             size_t length;
+            void *map; /// mapping to unmap on close (mmap mode)
+            size_t map_length;
+
+            // feed mode
+            const char *chunk; /// the last fed chunk
+            size_t chunk_length;
+            size_t chunk_offset; /// bytes of chunk given to window or carry
+            char *carry; /// incomplete pair kept between chunks
+            size_t carry_fill;
+            size_t carry_size;
+            size_t carry_chunk; /// bytes at the end of carry taken from chunk
+            bool final; /// no more chunks
+            bool eof; /// end of window was read
+            bool unread; /// chunk is not read up to JSON_END yet
         } buffer;
         struct {
             void *ptr;
@@ -108,6 +192,58 @@ typedef struct json_source {
 }json_source;
 
 
+/*
+ * key at some position of the objects of one shape: objects mostly have
+ * the same keys in the same order, so the key read is compared with the
+ * predicted one before hashing (as hidden classes of JS engines)
+ * */
+struct kvp_shape_key {
+    size_t offset; /// of key text in kvp_shape.text
+    size_t length;
+    size_t id; /// interned id
+    bool wanted; /// passed key filter
+};
+
+/*
+ * keys of the objects of one shape in order
+ * */
+struct kvp_shape {
+    struct kvp_shape_key *keys;
+    size_t count;
+    size_t size;
+    char *text; /// texts of keys
+    size_t text_size;
+    size_t used; /// last object of the shape, for replacement
+};
+
+#define KVP_SHAPE_CACHE 4 /// number of shapes remembered
+
+/*
+ * last shapes of objects read, with counts of keys predicted by them
+ * */
+struct kvp_shapes {
+    struct kvp_shape shape[KVP_SHAPE_CACHE];
+    size_t current; /// shape of the object read
+    size_t objects; /// objects started, clock for kvp_shape.used
+    size_t hits; /// keys equal to the predicted ones
+    size_t misses; /// keys looked up in hash tables
+};
+
+/*
+ * counters of the work of iterator, counted only if the library is compiled
+ * with KVP_STATS (otherwise they stay zero and kvp_get_stats returns false);
+ * the iterator has them either way, so its layout does not depend on the flag
+ * */
+typedef struct kvp_stats {
+    size_t bytes; /// bytes consumed (feed source: bytes of chunks fed)
+    size_t tokens[JSON_END + 1]; /// keys and values read by type
+    size_t keys; /// keys of them
+    size_t escapes; /// escape sequences decoded in strings
+    size_t utf8; /// multibyte UTF-8 sequences in strings
+    size_t reallocs; /// growths of data.string by pushchar
+    size_t peak_string_size; /// the largest data.string_size
+} kvp_stats;
+
 /*
  * Iterator to keep current element of JSON
  * Keeps:
@@ -117,18 +253,25 @@ typedef struct json_source {
  * */
 typedef struct kvp_iterator{
 
-    size_t lineno; /// current line
+    size_t lineno; /// current line (newlines before source.line_position)
     size_t ntokens; /// current token number
     
-    int figure_brackets; /// open ot closed bracket
-    int comas; // number of comas
-    int semis; // number of semicolons
+    enum kvp_state_machine_type state; /// structural byte expected
+    int comas; // number of comas, index of key in object
     
     // data is stored in buffer
     struct {
         char *string;
         size_t string_fill;
         size_t string_size;        
+        const char *view; /// data in buffer source, if not NULL string is not filled
+        size_t view_length;
+        struct kvp_number number; /// value of JSON_NUMBER
+        char *key; /// copy of the key read by kvp_next_pair
+        size_t key_size;
+        char *batch; /// copies of texts of the last kvp_next_batch
+        size_t batch_fill;
+        size_t batch_size;
     } data; /// data
     
    bool isKey; /// is is key or value
@@ -137,6 +280,12 @@ typedef struct kvp_iterator{
   
    unsigned flags;
       
+   struct kvphash_table *filter; /// keys to read, others are skipped if set
+   struct kvphash_table *keys; /// table of interned keys if set
+   size_t key_id; /// id of the last key if keys are interned
+   struct kvp_shapes shapes; /// keys predicted for filter and interning
+   kvp_stats stats; /// see kvp_get_stats
+
    struct json_source source; /// source
    struct kvp_allocator alloc; /// allocator
    char errmsg[LEN_ERROR_MSG]; // error message
@@ -149,6 +298,11 @@ typedef struct kvp_iterator{
  * read KVP from buffer mode 
  * */
 void kvp_open_buffer(kvp_iterator *json, const void *buffer, size_t size);
+/*
+ * read KVP from another buffer with the iterator opened by
+ * kvp_open_buffer before: keeps its allocator and data buffer
+ * */
+void kvp_reopen_buffer(kvp_iterator *json, const void *buffer, size_t size);
 /*
  * read KVP from string mode 
  * */
@@ -158,6 +312,39 @@ void kvp_open_string(kvp_iterator *json, const char *string);
  * */
 void kvp_open_stream(kvp_iterator *json, FILE *stream);
 
+/*
+ * read KVP from file descriptor mode:
+ * reads blocks of block_size bytes (KVP_FD_BLOCK_SIZE if 0)
+ * into buffer owned by iterator; descriptor is not closed
+ * */
+void kvp_open_fd(kvp_iterator *json, int fd, size_t block_size);
+
+/*
+ * read KVP from memory mapped file mode:
+ * maps the file read-only and reads it as buffer;
+ * returns 0 on success, -1 on error (see kvp_get_error)
+ * */
+int kvp_open_mmap(kvp_iterator *json, const char *path);
+
+/*
+ * read KVP pushed by kvp_feed in chunks (push mode);
+ * pairs are read with kvp_next_pair or kvp_next_batch
+ * */
+void kvp_open_feed(kvp_iterator *json);
+
+/*
+ * push next chunk of input, NULL or zero length marks the end of input;
+ * then kvp_next_pair returns pairs completed in it until JSON_END,
+ * which means all of the chunk is used and the next one is needed
+ * (or the end if it was marked); a chunk pushed before that fails with
+ * "previous chunk is not read". An incomplete pair at the end of the
+ * chunk (including partial strings, escapes and UTF-8 sequences) is
+ * copied and read again with the next chunk; texts of pairs may point
+ * into the chunk, so it must stay valid while they are used.
+ * Returns 0 on success, -1 on error (see kvp_get_error)
+ * */
+int kvp_feed(kvp_iterator *json, const void *chunk, size_t length);
+
 /*
  * read KVP from user cosole mode 
  * */
@@ -174,6 +361,44 @@ void kvp_set_allocator(kvp_iterator *json, kvp_allocator *a);
 
 void kvp_set_streaming(kvp_iterator *json, bool mode);
 
+/*
+ * read only keys of the set (hash table of kvphash_table.h, values are
+ * not used) and their values; other pairs are skipped by kvp_next and
+ * kvp_next_pair without unescaping or validating their values;
+ * NULL reads all keys. The table must outlive the iterator.
+ * */
+void kvp_set_key_filter(kvp_iterator *json, struct kvphash_table *keys);
+
+/*
+ * intern keys into the table (kvphash_table.h): the key is hashed once
+ * while it is read, a new key is added to the table with id
+ * ht_length + 1 as value ((void*)(uintptr_t)id), so ids of the keys
+ * added by iterators are 1,2,3...; values of keys already in the table
+ * are taken as their ids. The id of the last key is returned by
+ * kvp_get_key_id and set to kvp_pair.key_id. NULL stops interning.
+ * The table must outlive the iterator.
+ * */
+void kvp_set_key_interning(kvp_iterator *json, struct kvphash_table *keys);
+
+/*
+ * id of the last key read if keys are interned, 0 otherwise
+ * */
+size_t kvp_get_key_id(kvp_iterator *json);
+
+/*
+ * counts of keys resolved by shape prediction (the key is the same as
+ * at this position of a recent object with the same keys before it) and
+ * keys which needed hashing and lookup in the filter or interned keys
+ * tables
+ * */
+void kvp_get_shape_stats(kvp_iterator *json, size_t *hits, size_t *misses);
+
+/*
+ * copy counters of the iterator into stats; returns false (stats are
+ * zeroed) if the library is compiled without KVP_STATS
+ * */
+bool kvp_get_stats(kvp_iterator *json, kvp_stats *stats);
+
 
 /*
  *  go to the next JSON value
@@ -181,6 +406,38 @@ void kvp_set_streaming(kvp_iterator *json, bool mode);
 enum kvp_json_type kvp_next(kvp_iterator *json);
 //enum kv_state_machine_type json_peek_pair(kvp_iterator *json);
 
+/*
+ * key and value read at once
+ * */
+typedef struct kvp_pair {
+    const char *key; /// text of key, not zero terminated
+    size_t key_length;
+    size_t key_id; /// id of the key if keys are interned, 0 otherwise
+    const char *value; /// as kvp_get_string_view, "1"/"0" for true/false/null
+    size_t value_length;
+    enum kvp_json_type type; /// type of value
+    bool integer; /// number is integral and fits scalar.integer
+    union {
+        int64_t integer;
+        double real; /// other numbers
+        bool boolean; /// JSON_TRUE/JSON_FALSE
+    } scalar; /// parsed value of number or literal
+} kvp_pair;
+
+/*
+ *  go to the next key and value, fill pair with them;
+ *  returns type of value, JSON_END or JSON_ERROR;
+ *  texts are valid until next call
+ * */
+enum kvp_json_type kvp_next_pair(kvp_iterator *json, kvp_pair *pair);
+
+/*
+ *  read up to count pairs into array pairs; returns number of pairs read,
+ *  if less than count kvp_get_type tells JSON_END or JSON_ERROR;
+ *  texts of all pairs are valid until next call
+ * */
+size_t kvp_next_batch(kvp_iterator *json, kvp_pair *pairs, size_t count);
+
 /*
  * initialize iterator
  * */
@@ -197,9 +454,18 @@ void kvp_reset_iterator(kvp_iterator *json);
 const char * kvp_get_string(kvp_iterator *json, size_t *length);
 
 
+/*
+ * return string or number data without copying:
+ * points into buffer/mmap source when the value had no escapes,
+ * otherwise into the iterator buffer; valid until next kvp_next;
+ * length does not count terminating zero (which a view has not);
+ * returns false for other types
+ * */
+bool kvp_get_string_view(kvp_iterator *json, const char **ptr, size_t *length);
+
 size_t kvp_save_string(kvp_iterator *json, char *buf);
 /*
- * return double number of data
+ * return double number of data, see kvp_get_double
  * */
 double kvp_get_number(kvp_iterator *json);
 
@@ -208,6 +474,25 @@ double kvp_get_number(kvp_iterator *json);
  * */
 int kvp_get_int(kvp_iterator *json);
 
+/*
+ * is number integral (has no fraction or exponent part)
+ * */
+bool kvp_is_integer(kvp_iterator *json);
+
+/*
+ * return integral number which fits int64_t / uint64_t into value;
+ * false if number is not integral or out of range
+ * */
+bool kvp_get_int64(kvp_iterator *json, int64_t *value);
+bool kvp_get_uint64(kvp_iterator *json, uint64_t *value);
+
+/*
+ * return number as double, correctly rounded; the text of a string
+ * value is read as a number (0 if it is not one); '.' is the decimal
+ * point in any locale
+ * */
+double kvp_get_double(kvp_iterator *json);
+
 /*
  * return arbitrary value as char*
  * */
@@ -215,9 +500,17 @@ bool kvp_get_value(kvp_iterator *json, char* buf, size_t *length);
 
 
 /*
- * get number of line
+ * get number of line (newlines read before the current position); for
+ * buffer, mmap, feed and fd sources newlines are counted when asked
  * */
 size_t kvp_get_lineno(kvp_iterator *json);
+
+/*
+ * get column: bytes of the current line read, the last one is the
+ * current byte (which failed on error); 0 at the line start or if the
+ * line start is not known (stream, user and feed sources)
+ * */
+size_t kvp_get_column(kvp_iterator *json);
 /*
  * get position
  * */
@@ -233,6 +526,78 @@ enum kvp_json_type kvp_get_type(kvp_iterator *json);
 const char *kvp_get_error(kvp_iterator *json);
 
 
+/*
+ * entry of the tape: key or value found by kvp_parse_tape
+ * */
+#define KVP_TAPE_KEY (1u << 0) /// entry is a key
+#define KVP_TAPE_ESCAPED (1u << 1) /// text is unescaped copy in tape strings
+
+typedef struct kvp_tape_entry {
+    size_t offset; /// of text in source buffer or tape strings
+    size_t length; /// of text, without terminating zero
+    enum kvp_json_type type;
+    unsigned flags;
+} kvp_tape_entry;
+
+/*
+ * Tape of all keys and values of a buffer, built in two stages:
+ * index of structural bytes (quotes and {}:, outside strings) found
+ * with SIMD, then entries read at the indexed positions.
+ * Plain strings and numbers point into the source buffer, which must
+ * outlive the tape.
+ * */
+typedef struct kvp_tape {
+    kvp_tape_entry *entries;
+    size_t count;
+    size_t capacity;
+
+    const char *buffer; /// source text
+    char *strings; /// unescaped strings, zero terminated
+    size_t strings_fill;
+    size_t strings_size;
+
+    size_t *index; /// structural positions of stage one
+    size_t index_count;
+    size_t index_capacity;
+
+    struct kvp_allocator alloc;
+} kvp_tape;
+
+/*
+ * initialize empty tape, free it with kvp_tape_close
+ * */
+void kvp_tape_init(kvp_tape *tape);
+void kvp_tape_set_allocator(kvp_tape *tape, kvp_allocator *a);
+void kvp_tape_close(kvp_tape *tape);
+
+/*
+ * parse whole buffer or mmap source of the iterator into the tape;
+ * entries are the same as returned by kvp_next, the iterator is left
+ * at the end of input;
+ * returns 0 on success, -1 on error (see kvp_get_error), entries
+ * before the error are kept
+ * */
+int kvp_parse_tape(kvp_iterator *json, kvp_tape *tape);
+
+/*
+ * number of entries in tape
+ * */
+size_t kvp_tape_size(const kvp_tape *tape);
+
+/*
+ * return type and text of entry i as kvp_get_string_view does
+ * (true/false/null as "1"/"0"), JSON_END past the last entry
+ * */
+enum kvp_json_type kvp_tape_get(const kvp_tape *tape, size_t i, const char **ptr, size_t *length);
+
+bool kvp_tape_is_key(const kvp_tape *tape, size_t i);
+
+/*
+ * number value of entry i, see kvp_get_int64 and kvp_get_double
+ * */
+bool kvp_tape_get_int64(const kvp_tape *tape, size_t i, int64_t *value);
+double kvp_tape_get_double(const kvp_tape *tape, size_t i);
+
 
 #ifdef __cplusplus
 } /* extern "C" */
@@ -0,0 +1,593 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2022, Viktor Borodin
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+ *  Vectorized scanners for contiguous input (buffer, mmap and fd block
+ *  windows). SSE2 is used on every x86-64 build, AVX2 when the compiler
+ *  targets it (-mavx2 or -march=native); other targets use scalar loops.
+ *  UTF-8 validation needs SSSE3, which GCC and Clang builds pick at run
+ *  time when the compiler does not target it already.
+ */
+
+#ifndef __KVP_SIMD_H__
+#define __KVP_SIMD_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "utilits.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define KVP_SIMD_AVX2 1
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define KVP_SIMD_SSE2 1
+#endif
+
+#if defined(__SSSE3__) || defined(KVP_SIMD_AVX2)
+#include <tmmintrin.h>
+#define KVP_SIMD_SSSE3 1
+#define KVP_TARGET_SSSE3
+#define kvp_has_ssse3() 1
+#elif defined(KVP_SIMD_SSE2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <tmmintrin.h>
+#define KVP_SIMD_SSSE3 1
+#define KVP_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define kvp_has_ssse3() __builtin_cpu_supports("ssse3")
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+static __inline unsigned kvp_ctz32(uint32_t x)
+{
+    unsigned long i;
+    _BitScanForward(&i, x);
+    return (unsigned)i;
+}
+static __inline unsigned kvp_popcount32(uint32_t x)
+{
+    return (unsigned)__popcnt(x);
+}
+static __inline unsigned kvp_ctz64(uint64_t x)
+{
+    unsigned long i;
+    _BitScanForward64(&i, x);
+    return (unsigned)i;
+}
+static __inline unsigned kvp_clz64(uint64_t x)
+{
+    unsigned long i;
+    _BitScanReverse64(&i, x);
+    return 63 - (unsigned)i;
+}
+#else
+#define kvp_ctz32(x) ((unsigned)__builtin_ctz(x))
+#define kvp_ctz64(x) ((unsigned)__builtin_ctzll(x))
+#define kvp_clz64(x) ((unsigned)__builtin_clzll(x))
+#ifdef __POPCNT__
+#define kvp_popcount32(x) ((unsigned)__builtin_popcount(x))
+#else
+// without popcnt instruction the builtin is a library call
+static inline unsigned kvp_popcount32(uint32_t x)
+{
+    x = x - ((x >> 1) & 0x55555555u);
+    x = (x & 0x33333333u) + ((x >> 2) & 0x33333333u);
+    x = (x + (x >> 4)) & 0x0F0F0F0Fu;
+    return (x * 0x01010101u) >> 24;
+}
+#endif
+#endif
+
+/*
+ * Returns index of the first byte in p[0..n) which stops a plain string run:
+ * quote, backslash or control character; n if there is none.
+ * Non-ASCII bytes are part of the run and are checked by kvp_validate_utf8.
+ * */
+static inline size_t kvp_scan_string(const char* p, size_t n)
+{
+    size_t i = 0;
+
+    // saturating subtract leaves zero exactly for bytes <= 0x1F
+#ifdef KVP_SIMD_AVX2
+    const __m256i quote32 = _mm256_set1_epi8('"');
+    const __m256i slash32 = _mm256_set1_epi8('\\');
+    const __m256i ctrl32 = _mm256_set1_epi8(0x1F);
+    const __m256i zero32 = _mm256_setzero_si256();
+    for(; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+        __m256i stop = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote32), _mm256_cmpeq_epi8(v, slash32)),
+            _mm256_cmpeq_epi8(_mm256_subs_epu8(v, ctrl32), zero32));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(stop);
+        if(mask != 0)
+            return i + kvp_ctz32(mask);
+    }
+#endif
+#ifdef KVP_SIMD_SSE2
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i slash = _mm_set1_epi8('\\');
+    const __m128i ctrl = _mm_set1_epi8(0x1F);
+    const __m128i zero = _mm_setzero_si128();
+    for(; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        __m128i stop = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, slash)),
+            _mm_cmpeq_epi8(_mm_subs_epu8(v, ctrl), zero));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(stop);
+        if(mask != 0)
+            return i + kvp_ctz32(mask);
+    }
+#endif
+    for(; i < n; i++) {
+        unsigned char c = (unsigned char)p[i];
+        if(c == '"' || c == '\\' || c < 0x20)
+            return i;
+    }
+    return n;
+}
+
+/*
+ * Returns number of bytes at the end of p[0..n) which start a UTF-8
+ * sequence continued past n, 0 if the last sequence is complete.
+ * */
+static inline size_t kvp_utf8_incomplete_tail(const char* p, size_t n)
+{
+    for(size_t i = 1; i <= 3 && i <= n; i++) {
+        unsigned char c = (unsigned char)p[n - i];
+        if(c < 0x80)
+            return 0;
+        if(c >= 0xC0) {
+            size_t need = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : 2;
+            return need > i ? i : 0;
+        }
+    }
+    return 0;
+}
+
+/* Scalar validation, used for short input and where SSSE3 is missing */
+static inline bool kvp_validate_utf8_scalar(const unsigned char* p, size_t n)
+{
+    size_t i = 0;
+    while(i < n) {
+        // skip ASCII 8 bytes at a time
+        if(i + 8 <= n) {
+            uint64_t word;
+            memcpy(&word, p + i, 8);
+            if((word & 0x8080808080808080ULL) == 0) {
+                i += 8;
+                continue;
+            }
+        }
+        unsigned char c = p[i];
+        if(c < 0x80) {
+            i++;
+            continue;
+        }
+        // lead byte gives length and the allowed range of the second byte
+        size_t len;
+        unsigned char lo = 0x80, hi = 0xBF;
+        if(c >= 0xC2 && c <= 0xDF)
+            len = 2;
+        else if(c >= 0xE0 && c <= 0xEF) {
+            len = 3;
+            if(c == 0xE0)
+                lo = 0xA0;
+            else if(c == 0xED)
+                hi = 0x9F;
+        } else if(c >= 0xF0 && c <= 0xF4) {
+            len = 4;
+            if(c == 0xF0)
+                lo = 0x90;
+            else if(c == 0xF4)
+                hi = 0x8F;
+        } else
+            return false;
+        if(i + len > n || p[i + 1] < lo || p[i + 1] > hi)
+            return false;
+        for(size_t k = 2; k < len; k++)
+            if((p[i + k] & 0xC0) != 0x80)
+                return false;
+        i += len;
+    }
+    return true;
+}
+
+#ifdef KVP_SIMD_SSSE3
+
+/* Error bits of the lookup tables, see "Validating UTF-8 In Less Than One
+ * Instruction Per Byte" (Keiser, Lemire) */
+#define KVP_U8_TOO_SHORT (1 << 0)
+#define KVP_U8_TOO_LONG (1 << 1)
+#define KVP_U8_OVERLONG_3 (1 << 2)
+#define KVP_U8_TOO_LARGE (1 << 3)
+#define KVP_U8_SURROGATE (1 << 4)
+#define KVP_U8_OVERLONG_2 (1 << 5)
+#define KVP_U8_TOO_LARGE_1000 (1 << 6)
+#define KVP_U8_OVERLONG_4 (1 << 6)
+#define KVP_U8_TWO_CONTS (1 << 7)
+#define KVP_U8_CARRY (KVP_U8_TOO_SHORT | KVP_U8_TOO_LONG | KVP_U8_TWO_CONTS)
+
+/* Returns non-zero bytes where input (preceded by prev) is not valid UTF-8 */
+KVP_TARGET_SSSE3 static inline __m128i kvp_utf8_check16(__m128i input, __m128i prev)
+{
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i byte_1_high_table = _mm_setr_epi8(
+        // 0_______ ________ <ASCII in byte 1>
+        KVP_U8_TOO_LONG, KVP_U8_TOO_LONG, KVP_U8_TOO_LONG, KVP_U8_TOO_LONG,
+        KVP_U8_TOO_LONG, KVP_U8_TOO_LONG, KVP_U8_TOO_LONG, KVP_U8_TOO_LONG,
+        // 10______ ________ <continuation in byte 1>
+        (char)KVP_U8_TWO_CONTS, (char)KVP_U8_TWO_CONTS, (char)KVP_U8_TWO_CONTS, (char)KVP_U8_TWO_CONTS,
+        // 1100____ ________ <two byte lead in byte 1>
+        KVP_U8_TOO_SHORT | KVP_U8_OVERLONG_2,
+        // 1101____ ________ <two byte lead in byte 1>
+        KVP_U8_TOO_SHORT,
+        // 1110____ ________ <three byte lead in byte 1>
+        KVP_U8_TOO_SHORT | KVP_U8_OVERLONG_3 | KVP_U8_SURROGATE,
+        // 1111____ ________ <four+ byte lead in byte 1>
+        KVP_U8_TOO_SHORT | KVP_U8_TOO_LARGE | KVP_U8_TOO_LARGE_1000 | KVP_U8_OVERLONG_4);
+    const __m128i byte_1_low_table = _mm_setr_epi8(
+        // ____0000 ________
+        (char)(KVP_U8_CARRY | KVP_U8_OVERLONG_3 | KVP_U8_OVERLONG_2 | KVP_U8_OVERLONG_4),
+        // ____0001 ________
+        (char)(KVP_U8_CARRY | KVP_U8_OVERLONG_2),
+        // ____001_ ________
+        (char)KVP_U8_CARRY, (char)KVP_U8_CARRY,
+        // ____0100 ________
+        (char)(KVP_U8_CARRY | KVP_U8_TOO_LARGE),
+        // ____0101 ________ and above
+        (char)(KVP_U8_CARRY | KVP_U8_TOO_LARGE | KVP_U8_TOO_LARGE_1000),
+        (char)(KVP_U8_CARRY | KVP_U8_TOO_LARGE | KVP_U8_TOO_LARGE_1000),
+        (char)(KVP_U8_CARRY | KVP_U8_TOO_LARGE | KVP_U8_TOO_LARGE_1000),
+        (char)(KVP_U8_CARRY | KVP_U8_TOO_LARGE | KVP_U8_TOO_LARGE_1000),
+        (char)(KVP_U8_CARRY | KVP_U8_TOO_LARGE | KVP_U8_TOO_LARGE_1000),
+        (char)(KVP_U8_CARRY | KVP_U8_TOO_LARGE | KVP_U8_TOO_LARGE_1000),
+        (char)(KVP_U8_CARRY | KVP_U8_TOO_LARGE | KVP_U8_TOO_LARGE_1000),
+        (char)(KVP_U8_CARRY | KVP_U8_TOO_LARGE | KVP_U8_TOO_LARGE_1000),
+        // ____1101 ________
+        (char)(KVP_U8_CARRY | KVP_U8_TOO_LARGE | KVP_U8_TOO_LARGE_1000 | KVP_U8_SURROGATE),
+        (char)(KVP_U8_CARRY | KVP_U8_TOO_LARGE | KVP_U8_TOO_LARGE_1000),
+        (char)(KVP_U8_CARRY | KVP_U8_TOO_LARGE | KVP_U8_TOO_LARGE_1000));
+    const __m128i byte_2_high_table = _mm_setr_epi8(
+        // ________ 0_______ <ASCII in byte 2>
+        KVP_U8_TOO_SHORT, KVP_U8_TOO_SHORT, KVP_U8_TOO_SHORT, KVP_U8_TOO_SHORT,
+        KVP_U8_TOO_SHORT, KVP_U8_TOO_SHORT, KVP_U8_TOO_SHORT, KVP_U8_TOO_SHORT,
+        // ________ 1000____
+        (char)(KVP_U8_TOO_LONG | KVP_U8_OVERLONG_2 | KVP_U8_TWO_CONTS | KVP_U8_OVERLONG_3 | KVP_U8_TOO_LARGE_1000 |
+            KVP_U8_OVERLONG_4),
+        // ________ 1001____
+        (char)(KVP_U8_TOO_LONG | KVP_U8_OVERLONG_2 | KVP_U8_TWO_CONTS | KVP_U8_OVERLONG_3 | KVP_U8_TOO_LARGE),
+        // ________ 101_____
+        (char)(KVP_U8_TOO_LONG | KVP_U8_OVERLONG_2 | KVP_U8_TWO_CONTS | KVP_U8_SURROGATE | KVP_U8_TOO_LARGE),
+        (char)(KVP_U8_TOO_LONG | KVP_U8_OVERLONG_2 | KVP_U8_TWO_CONTS | KVP_U8_SURROGATE | KVP_U8_TOO_LARGE),
+        // ________ 11______
+        KVP_U8_TOO_SHORT, KVP_U8_TOO_SHORT, KVP_U8_TOO_SHORT, KVP_U8_TOO_SHORT);
+
+    __m128i prev1 = _mm_alignr_epi8(input, prev, 15);
+    __m128i byte_1_high = _mm_shuffle_epi8(byte_1_high_table, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+    __m128i byte_1_low = _mm_shuffle_epi8(byte_1_low_table, _mm_and_si128(prev1, nibble));
+    __m128i byte_2_high = _mm_shuffle_epi8(byte_2_high_table, _mm_and_si128(_mm_srli_epi16(input, 4), nibble));
+    __m128i special = _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low), byte_2_high);
+
+    // third and fourth bytes of 3/4-byte sequences must be continuations
+    __m128i prev2 = _mm_alignr_epi8(input, prev, 14);
+    __m128i prev3 = _mm_alignr_epi8(input, prev, 13);
+    __m128i is_third = _mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xE0 - 0x80)));
+    __m128i is_fourth = _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xF0 - 0x80)));
+    __m128i must23 = _mm_and_si128(_mm_or_si128(is_third, is_fourth), _mm_set1_epi8((char)0x80));
+    return _mm_xor_si128(must23, special);
+}
+
+KVP_TARGET_SSSE3 static inline bool kvp_validate_utf8_ssse3(const char* p, size_t n)
+{
+    __m128i error = _mm_setzero_si128();
+    __m128i prev = _mm_setzero_si128();
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        __m128i input = _mm_loadu_si128((const __m128i*)(p + i));
+        // ASCII block after ASCII block cannot be wrong
+        if(_mm_movemask_epi8(_mm_or_si128(input, prev)) != 0)
+            error = _mm_or_si128(error, kvp_utf8_check16(input, prev));
+        prev = input;
+    }
+    if(i < n) {
+        char tail[16] = { 0 };
+        memcpy(tail, p + i, n - i);
+        __m128i input = _mm_loadu_si128((const __m128i*)tail);
+        error = _mm_or_si128(error, kvp_utf8_check16(input, prev));
+        prev = input;
+    }
+    // zero block after the end flags the sequence cut at the end
+    error = _mm_or_si128(error, kvp_utf8_check16(_mm_setzero_si128(), prev));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) == 0xFFFF;
+}
+
+#endif /* KVP_SIMD_SSSE3 */
+
+/*
+ * Returns true if p[0..n) is complete well-formed UTF-8 (no overlong forms,
+ * surrogates or code points above U+10FFFF); pure ASCII is only scanned.
+ * */
+static inline bool kvp_validate_utf8(const char* p, size_t n)
+{
+#ifdef KVP_SIMD_SSSE3
+    if(n >= 16 && kvp_has_ssse3())
+        return kvp_validate_utf8_ssse3(p, n);
+#endif
+    return kvp_validate_utf8_scalar((const unsigned char*)p, n);
+}
+
+/*
+ * Returns index of the first non-space byte (in isspace sense of the
+ * C locale) in p[0..n), n if there is none; adds skipped '\n' to
+ * *newlines unless newlines is NULL.
+ * */
+static inline size_t kvp_skip_space(const char* p, size_t n, size_t* newlines)
+{
+    size_t i = 0;
+
+    // whitespace between tokens is mostly short, check the first byte
+    // before touching vector registers
+    if(n > 0 && (unsigned char)p[0] > ' ')
+        return 0;
+
+#ifdef KVP_SIMD_SSE2
+    const __m128i blank = _mm_set1_epi8(' ');
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i tab_lo = _mm_set1_epi8('\t' - 1);
+    const __m128i tab_hi = _mm_set1_epi8('\r' + 1);
+    for(; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        // '\t'..'\r' range covers \t \n \v \f \r
+        __m128i space = _mm_or_si128(_mm_cmpeq_epi8(v, blank),
+            _mm_and_si128(_mm_cmpgt_epi8(v, tab_lo), _mm_cmplt_epi8(v, tab_hi)));
+        uint32_t other = ~(uint32_t)_mm_movemask_epi8(space) & 0xFFFFu;
+        if(other != 0) {
+            unsigned k = kvp_ctz32(other);
+            if(newlines != NULL)
+                *newlines += kvp_popcount32((uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)) & ((1u << k) - 1));
+            return i + k;
+        }
+        if(newlines != NULL)
+            *newlines += kvp_popcount32((uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)));
+    }
+#endif
+    for(; i < n; i++) {
+        unsigned char c = (unsigned char)p[i];
+        if(c == '\n') {
+            if(newlines != NULL)
+                (*newlines)++;
+        } else if(c != ' ' && (c < '\t' || c > '\r')) {
+            return i;
+        }
+    }
+    return n;
+}
+
+/*
+ * Returns number of '\n' bytes in p[0..n)
+ * */
+static inline size_t kvp_count_newlines(const char* p, size_t n)
+{
+    size_t count = 0;
+    size_t i = 0;
+
+#if defined(KVP_SIMD_AVX2)
+    const __m256i nl32 = _mm256_set1_epi8('\n');
+    for(; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+        count += kvp_popcount32((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl32)));
+    }
+#endif
+#ifdef KVP_SIMD_SSE2
+    const __m128i nl = _mm_set1_epi8('\n');
+    for(; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        count += kvp_popcount32((uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)));
+    }
+#endif
+    for(; i < n; i++)
+        count += p[i] == '\n';
+    return count;
+}
+
+/*
+ * Returns number of UTF-8 lead bytes of multibyte sequences (0xC0 and
+ * above) in p[0..n)
+ * */
+static inline size_t kvp_count_utf8_leads(const char* p, size_t n)
+{
+    size_t count = 0;
+    size_t i = 0;
+
+#ifdef KVP_SIMD_SSE2
+    const __m128i below_lead = _mm_set1_epi8((char)0xBF); // signed -65
+    for(; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        count += kvp_popcount32((uint32_t)_mm_movemask_epi8(_mm_cmpgt_epi8(v, below_lead)) &
+                                (uint32_t)_mm_movemask_epi8(v));
+    }
+#endif
+    for(; i < n; i++)
+        count += (unsigned char)p[i] >= 0xC0;
+    return count;
+}
+
+/*
+ * Returns index of the closing quote in string text p[0..n), skipping
+ * bytes escaped by backslash, n if there is none; *escaped tells that
+ * p[0] is escaped and is set for the byte following p[n - 1].
+ * */
+static inline size_t kvp_find_quote(const char* p, size_t n, bool* escaped)
+{
+    size_t i = 0;
+    bool esc = *escaped;
+#ifdef KVP_SIMD_SSE2
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i slash = _mm_set1_epi8('\\');
+    for(; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        uint32_t q = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, quote));
+        uint32_t m = q | (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, slash));
+        if(esc) {
+            m &= ~1u;
+            esc = false;
+        }
+        while(m != 0) {
+            unsigned k = kvp_ctz32(m);
+            if(q & (1u << k)) {
+                *escaped = false;
+                return i + k;
+            }
+            if(k == 15) {
+                esc = true; // backslash escapes first byte of the next block
+                break;
+            }
+            m &= ~(3u << k);
+        }
+    }
+#endif
+    for(; i < n; i++) {
+        if(esc) {
+            esc = false;
+        } else if(p[i] == '"') {
+            *escaped = false;
+            return i;
+        } else if(p[i] == '\\') {
+            esc = true;
+        }
+    }
+    *escaped = esc;
+    return n;
+}
+
+/*
+ * State of the structural scan carried from one 64 byte block to the next
+ * */
+typedef struct kvp_structural_state {
+    uint64_t escaped; /// 1 if the previous block ended with odd run of backslashes
+    uint64_t in_string; /// all ones if the previous block ended inside a string
+} kvp_structural_state;
+
+/* Sets bit masks of quotes, backslashes and {}:, bytes of p[0..64) */
+static inline void kvp_classify64(const char* p, uint64_t* quote, uint64_t* slash, uint64_t* op)
+{
+#if defined(KVP_SIMD_AVX2)
+    const __m256i quote32 = _mm256_set1_epi8('"');
+    const __m256i slash32 = _mm256_set1_epi8('\\');
+    const __m256i open32 = _mm256_set1_epi8('{');
+    const __m256i close32 = _mm256_set1_epi8('}');
+    const __m256i colon32 = _mm256_set1_epi8(':');
+    const __m256i comma32 = _mm256_set1_epi8(',');
+    *quote = *slash = *op = 0;
+    for(int i = 0; i < 64; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+        __m256i o = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, open32), _mm256_cmpeq_epi8(v, close32)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, colon32), _mm256_cmpeq_epi8(v, comma32)));
+        *quote |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, quote32)) << i;
+        *slash |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, slash32)) << i;
+        *op |= (uint64_t)(uint32_t)_mm256_movemask_epi8(o) << i;
+    }
+#elif defined(KVP_SIMD_SSE2)
+    const __m128i quote16 = _mm_set1_epi8('"');
+    const __m128i slash16 = _mm_set1_epi8('\\');
+    const __m128i open16 = _mm_set1_epi8('{');
+    const __m128i close16 = _mm_set1_epi8('}');
+    const __m128i colon16 = _mm_set1_epi8(':');
+    const __m128i comma16 = _mm_set1_epi8(',');
+    *quote = *slash = *op = 0;
+    for(int i = 0; i < 64; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        __m128i o = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, open16), _mm_cmpeq_epi8(v, close16)),
+            _mm_or_si128(_mm_cmpeq_epi8(v, colon16), _mm_cmpeq_epi8(v, comma16)));
+        *quote |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, quote16)) << i;
+        *slash |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, slash16)) << i;
+        *op |= (uint64_t)(uint32_t)_mm_movemask_epi8(o) << i;
+    }
+#else
+    *quote = *slash = *op = 0;
+    for(int i = 0; i < 64; i++) {
+        char c = p[i];
+        if(c == '"')
+            *quote |= (uint64_t)1 << i;
+        else if(c == '\\')
+            *slash |= (uint64_t)1 << i;
+        else if(c == '{' || c == '}' || c == ':' || c == ',')
+            *op |= (uint64_t)1 << i;
+    }
+#endif
+}
+
+/*
+ * Returns mask of bytes escaped by backslash: the byte after each odd
+ * length run of backslashes (runs may start in the previous block)
+ * */
+static inline uint64_t kvp_escaped_mask(uint64_t slash, uint64_t* prev_escaped)
+{
+    const uint64_t even_bits = 0x5555555555555555ULL;
+    const uint64_t odd_bits = ~even_bits;
+    uint64_t starts = slash & ~(slash << 1);
+    uint64_t even_start_mask = even_bits ^ *prev_escaped;
+    uint64_t even_starts = starts & even_start_mask;
+    uint64_t odd_starts = starts & ~even_start_mask;
+    uint64_t even_carries = slash + even_starts;
+    uint64_t odd_carries = slash + odd_starts;
+    uint64_t ends_odd = odd_carries < slash; // run reaches the end of block
+    odd_carries |= *prev_escaped;
+    *prev_escaped = ends_odd;
+    uint64_t even_start_odd_end = even_carries & ~slash & odd_bits;
+    uint64_t odd_start_even_end = odd_carries & ~slash & even_bits;
+    return even_start_odd_end | odd_start_even_end;
+}
+
+/* Returns mask with bit i set to xor of bits 0..i of x */
+static inline uint64_t kvp_prefix_xor(uint64_t x)
+{
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+/*
+ * Returns mask of structural bytes of the 64 byte block p: unescaped
+ * quotes and {}:, outside of strings; the bytes following them are
+ * left to the caller
+ * */
+static inline uint64_t kvp_structural_mask64(const char* p, kvp_structural_state* state)
+{
+    uint64_t quote, slash, op;
+    kvp_classify64(p, &quote, &slash, &op);
+    if(slash != 0 || state->escaped != 0)
+        quote &= ~kvp_escaped_mask(slash, &state->escaped);
+    // bits from the opening quote up to the byte before the closing one
+    uint64_t in_string = kvp_prefix_xor(quote) ^ state->in_string;
+    state->in_string = (uint64_t)((int64_t)in_string >> 63);
+    return (op & ~in_string) | quote;
+}
+
+#endif // __KVP_SIMD_H__
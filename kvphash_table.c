@@ -28,6 +28,7 @@ Based upon modified code of
 
 
 #include "kvphash_table.h"
+#include "kvp_simd.h"
 
 #include <assert.h>
 #include <stdint.h>
@@ -36,7 +37,44 @@ Based upon modified code of
 
 
 
-#define INITIAL_CAPACITY 16  // must not be zero
+#define INITIAL_CAPACITY 16  // must be a power of two, at least HT_GROUP
+#define MIGRATE_ENTRIES 16   // entries indexed by each call while resizing
+#define KEY_BLOCK_SIZE 4096  // size of the first block of key texts
+#define KEY_BLOCK_MAX (1024 * 1024) // blocks double up to this size
+
+// Block of texts of keys longer than HT_SMALL_KEY, freed with the table.
+struct ht_key_block {
+    struct ht_key_block* next;
+    size_t size;        // bytes of text
+    size_t fill;        // bytes used
+    char text[];
+};
+
+// Allocate control bytes (all empty) and entry numbers of capacity slots.
+static bool ht_alloc(ht_index* index, size_t capacity) {
+    // Entry numbers are below capacity, take the smallest width for them.
+    unsigned width = capacity <= 0x100 ? 1 : capacity <= 0x10000 ? 2
+        : (uint64_t)capacity <= 0x100000000ULL ? 4 : 8;
+    index->control = malloc(capacity + HT_GROUP);
+    index->slots = malloc(capacity * width);
+    if (index->control == NULL || index->slots == NULL) {
+        free(index->control);
+        free(index->slots);
+        index->control = NULL;
+        return false;
+    }
+    memset(index->control, HT_EMPTY, capacity + HT_GROUP);
+    index->capacity = capacity;
+    index->width = width;
+    return true;
+}
+
+static void ht_free_index(ht_index* index) {
+    free(index->control);
+    free(index->slots);
+    index->control = NULL;
+    index->slots = NULL;
+}
 
 kvphash_table* ht_create(void) {
     // Allocate space for hash table struct.
@@ -45,11 +83,18 @@ kvphash_table* ht_create(void) {
         return NULL;
     }
     table->length = 0;
-    table->capacity = INITIAL_CAPACITY;
-
-    // Allocate (zero'd) space for entry buckets.
-    table->entries = calloc(table->capacity, sizeof(ht_item));
-    if (table->entries == NULL) {
+    for (size_t i = 0; i < HT_BLOCKS; i++) {
+        table->blocks[i] = NULL;
+    }
+    table->key_blocks = NULL;
+    table->incremental = false;
+    table->old.control = NULL;
+    table->old.slots = NULL;
+    table->migrated = 0;
+    table->migrate_end = 0;
+
+    // Allocate space for the index.
+    if (!ht_alloc(&table->index, INITIAL_CAPACITY)) {
         free(table); // error, free table before we return!
         return NULL;
     }
@@ -58,134 +103,376 @@ kvphash_table* ht_create(void) {
 }
 
 void ht_destroy(kvphash_table* table) {
-    // First free allocated keys.
-    for (size_t i = 0; i < table->capacity; i++) {
-        free((void*)table->entries[i].key);
+    // First free blocks of keys and entries.
+    while (table->key_blocks != NULL) {
+        struct ht_key_block* next = table->key_blocks->next;
+        free(table->key_blocks);
+        table->key_blocks = next;
+    }
+    for (size_t i = 0; i < HT_BLOCKS; i++) {
+        free(table->blocks[i]);
     }
 
-    // Then free entries array and table itself.
-    free(table->entries);
+    // Then free index and table itself.
+    ht_free_index(&table->index);
+    ht_free_index(&table->old);
     free(table);
 }
 
+// Return number of the block of entry i and set *offset to its offset
+// in the block; block k starts at entry HT_FIRST_BLOCK * (2^k - 1).
+static size_t entry_block(size_t i, size_t* offset) {
+    uint64_t j = (uint64_t)(i / HT_FIRST_BLOCK) + 1;
+    size_t k = 63 - (size_t)kvp_clz64(j);
+    *offset = i - HT_FIRST_BLOCK * (((size_t)1 << k) - 1);
+    return k;
+}
+
+ht_item* ht_entry(const kvphash_table* table, size_t i) {
+    size_t offset;
+    size_t k = entry_block(i, &offset);
+    return &table->blocks[k][offset];
+}
+
 #define FNV_OFFSET 14695981039346656037UL
 #define FNV_PRIME 1099511628211UL
 
-// Return 64-bit FNV-1a hash for key (NUL-terminated). See description:
+// Return 64-bit FNV-1a hash for key of length bytes. See description:
 // https://en.wikipedia.org/wiki/Fowler–Noll–Vo_hash_function
-static uint64_t hash_key(const char* key) {
+uint64_t ht_hash(const char* key, size_t length) {
     uint64_t hash = FNV_OFFSET;
-    for (const char* p = key; *p; p++) {
-        hash ^= (uint64_t)(unsigned char)(*p);
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint64_t)(unsigned char)key[i];
         hash *= FNV_PRIME;
     }
     return hash;
 }
 
-void* ht_get(kvphash_table* table, const char* key) {
-    // AND hash with capacity-1 to ensure it's within entries array.
-    uint64_t hash = hash_key(key);
-    size_t index = (size_t)(hash & (uint64_t)(table->capacity - 1));
-
-    // Loop till we find an empty entry.
-    while (table->entries[index].key != NULL) {
-        if (strcmp(key, table->entries[index].key) == 0) {
-            // Found key, return value.
-            return table->entries[index].value;
-        }
-        // Key wasn't in this slot, move to next (linear probing).
-        index++;
-        if (index >= table->capacity) {
-            // At end of entries array, wrap around.
-            index = 0;
-        }
-    }
-    return NULL;
+// Tag of hash kept in the control byte: its top 7 bits, the low ones
+// select the slot.
+static uint8_t hash_tag(uint64_t hash) {
+    return (uint8_t)(hash >> 57);
 }
 
+// Return bit mask of the bytes equal to byte among HT_GROUP control
+// bytes at p.
+static uint32_t group_match(const uint8_t* p, uint8_t byte) {
+#ifdef KVP_SIMD_SSE2
+    __m128i group = _mm_loadu_si128((const __m128i*)p);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)byte)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < HT_GROUP; i++) {
+        mask |= (uint32_t)(p[i] == byte) << i;
+    }
+    return mask;
+#endif
+}
 
+// Return entry number kept in slot.
+static size_t get_slot(const ht_index* index, size_t slot) {
+    switch (index->width) {
+    case 1:
+        return ((const uint8_t*)index->slots)[slot];
+    case 2:
+        return ((const uint16_t*)index->slots)[slot];
+    case 4:
+        return ((const uint32_t*)index->slots)[slot];
+    default:
+        return (size_t)((const uint64_t*)index->slots)[slot];
+    }
+}
 
+// Fill slot with entry number i and tag of its hash; the control byte
+// is copied after the end for the first slots.
+static void set_slot(ht_index* index, size_t slot, size_t i, uint64_t hash) {
+    switch (index->width) {
+    case 1:
+        ((uint8_t*)index->slots)[slot] = (uint8_t)i;
+        break;
+    case 2:
+        ((uint16_t*)index->slots)[slot] = (uint16_t)i;
+        break;
+    case 4:
+        ((uint32_t*)index->slots)[slot] = (uint32_t)i;
+        break;
+    default:
+        ((uint64_t*)index->slots)[slot] = i;
+        break;
+    }
+    index->control[slot] = hash_tag(hash);
+    if (slot < HT_GROUP) {
+        index->control[index->capacity + slot] = hash_tag(hash);
+    }
+}
 
-// Internal function to set an entry (without expanding table).
-static const char* ht_set_item(ht_item* entries, size_t capacity,
-        const char* key, void* value, size_t* plength) {
-    // AND hash with capacity-1 to ensure it's within entries array.
-    uint64_t hash = hash_key(key);
-    size_t index = (size_t)(hash & (uint64_t)(capacity - 1));
-
-    // Loop till we find an empty entry.
-    while (entries[index].key != NULL) {
-        if (strcmp(key, entries[index].key) == 0) {
-            // Found key (it already exists), update value.
-            entries[index].value = value;
-            return entries[index].key;
+// Find entry of key of length bytes with hash through index. Return it,
+// or NULL if key is not found; *empty is set to the first empty slot
+// probed, where key would be inserted.
+static ht_item* ht_find(const kvphash_table* table, const ht_index* index,
+        const char* key, size_t length, uint64_t hash, size_t* empty) {
+    size_t mask = index->capacity - 1;
+    size_t slot = (size_t)(hash & (uint64_t)mask);
+    uint8_t tag = hash_tag(hash);
+
+    // Probe groups of slots till one has an empty slot. Keys are only
+    // compared on equal tag, hash and length.
+    while (1) {
+        const uint8_t* group = index->control + slot;
+        for (uint32_t match = group_match(group, tag); match != 0;
+                match &= match - 1) {
+            ht_item* entry = ht_entry(table,
+                get_slot(index, (slot + kvp_ctz32(match)) & mask));
+            if (entry->hash == hash && entry->length == length &&
+                    memcmp(entry->key, key, length) == 0) {
+                return entry;
+            }
         }
-        // Key wasn't in this slot, move to next (linear probing).
-        index++;
-        if (index >= capacity) {
-            // At end of entries array, wrap around.
-            index = 0;
+        uint32_t empties = group_match(group, HT_EMPTY);
+        if (empties != 0) {
+            *empty = (slot + kvp_ctz32(empties)) & mask;
+            return NULL;
         }
+        // Load is kept below capacity, some group has an empty slot.
+        slot = (slot + HT_GROUP) & mask;
     }
+}
 
-    // Didn't find key, allocate+copy if needed, then insert it.
-    if (plength != NULL) {
-        key = strdup(key);
-        if (key == NULL) {
-            return NULL;
+// Put entry number i with hash into empty slot of an index being built.
+static void ht_index_entry(ht_index* index, size_t i, uint64_t hash) {
+    size_t mask = index->capacity - 1;
+    size_t slot = (size_t)(hash & (uint64_t)mask);
+    while (1) {
+        uint32_t empties = group_match(index->control + slot, HT_EMPTY);
+        if (empties != 0) {
+            slot = (slot + kvp_ctz32(empties)) & mask;
+            break;
         }
-        (*plength)++;
+        slot = (slot + HT_GROUP) & mask;
+    }
+    set_slot(index, slot, i, hash);
+}
+
+// Add up to count entries indexed only by the old index to the index
+// while the table is resized; the old index is freed when all are
+// added. Entries are not moved, only their numbers.
+static void ht_migrate(kvphash_table* table, size_t count) {
+    if (table->old.control == NULL) {
+        return;
+    }
+    // Entries inserted since the resize started are in the index already.
+    size_t end = table->migrate_end - table->migrated > count
+        ? table->migrated + count : table->migrate_end;
+    for (size_t i = table->migrated; i < end; i++) {
+        ht_index_entry(&table->index, i, ht_entry(table, i)->hash);
+    }
+    table->migrated = end;
+    if (end == table->migrate_end) {
+        ht_free_index(&table->old);
+        table->migrated = 0;
+        table->migrate_end = 0;
     }
-    entries[index].key = (char*)key;
-    entries[index].value = value;
-    return key;
 }
 
-// Expand hash table to twice its current size. Return true on success,
-// false if out of memory.
+// Find entry of key of length bytes with hash through both indexes.
+// Return it, or NULL if key is not found; *empty is set to the slot of
+// index where key would be inserted.
+static ht_item* ht_find_item(kvphash_table* table, const char* key,
+        size_t length, uint64_t hash, size_t* empty) {
+    ht_item* entry = ht_find(table, &table->index, key, length, hash, empty);
+    if (entry == NULL && table->old.control != NULL) {
+        size_t old_empty;
+        entry = ht_find(table, &table->old, key, length, hash, &old_empty);
+    }
+    return entry;
+}
+
+void* ht_get_hashed(kvphash_table* table, const char* key, size_t length,
+        uint64_t hash) {
+    ht_migrate(table, MIGRATE_ENTRIES);
+    size_t empty;
+    ht_item* entry = ht_find_item(table, key, length, hash, &empty);
+    return entry != NULL ? entry->value : NULL;
+}
+
+void* ht_get_n(kvphash_table* table, const char* key, size_t length) {
+    return ht_get_hashed(table, key, length, ht_hash(key, length));
+}
+
+void* ht_get(kvphash_table* table, const char* key) {
+    return ht_get_n(table, key, strlen(key));
+}
+
+// Expand index of hash table to twice its current size. Return true on
+// success, false if out of memory.
 static bool ht_expand(kvphash_table* table) {
-    // Allocate new entries array.
-    size_t new_capacity = table->capacity * 2;
-    if (new_capacity < table->capacity) {
+    // Previous resize must be finished.
+    ht_migrate(table, SIZE_MAX);
+
+    // Allocate new index.
+    size_t new_capacity = table->index.capacity * 2;
+    if (new_capacity < table->index.capacity) {
         return false;  // overflow (capacity would be too big)
     }
-    ht_item* new_entries = calloc(new_capacity, sizeof(ht_item));
-    if (new_entries == NULL) {
+    ht_index old = table->index;
+    if (!ht_alloc(&table->index, new_capacity)) {
+        table->index = old;
         return false;
     }
 
-    // Iterate entries, move all non-empty ones to new table's entries.
-    for (size_t i = 0; i < table->capacity; i++) {
-        ht_item entry = table->entries[i];
-        if (entry.key != NULL) {
-            ht_set_item(new_entries, new_capacity, entry.key,
-                         entry.value, NULL);
-        }
+    // Entries are added to the new index at once, or by ht_migrate on
+    // the next calls in incremental mode; stored hashes are not computed
+    // again.
+    table->old = old;
+    table->migrated = 0;
+    table->migrate_end = table->length;
+    if (!table->incremental) {
+        ht_migrate(table, SIZE_MAX);
     }
-
-    // Free old entries array and update this table's details.
-    free(table->entries);
-    table->entries = new_entries;
-    table->capacity = new_capacity;
     return true;
 }
 
 const char* ht_set(kvphash_table* table, const char* key, void* value) {
-    assert(value != NULL);
-    if (value == NULL) {
-        return NULL;
+    size_t length = strlen(key);
+    return ht_set_hashed(table, key, length, ht_hash(key, length), value);
+}
+
+// Copy key of length bytes with NUL after it into the key blocks.
+// Return the copy, or NULL if out of memory.
+static char* ht_store_key(kvphash_table* table, const char* key,
+        size_t length) {
+    struct ht_key_block* block = table->key_blocks;
+    size_t need = length + 1;
+    if (block == NULL || block->size - block->fill < need) {
+        size_t size = block == NULL ? KEY_BLOCK_SIZE : block->size * 2;
+        if (size > KEY_BLOCK_MAX) {
+            size = KEY_BLOCK_MAX;
+        }
+        if (size < need) {
+            size = need;
+        }
+        block = malloc(sizeof(struct ht_key_block) + size);
+        if (block == NULL) {
+            return NULL;
+        }
+        block->size = size;
+        block->fill = 0;
+        block->next = table->key_blocks;
+        table->key_blocks = block;
+    }
+    char* copy = block->text + block->fill;
+    memcpy(copy, key, length);
+    copy[length] = '\0';
+    block->fill += need;
+    return copy;
+}
+
+// Find entry of key of length bytes with hash, or insert it with NULL
+// value (*inserted is set then). Return the entry, or NULL if out of
+// memory.
+static ht_item* ht_upsert_item(kvphash_table* table, const char* key,
+        size_t length, uint64_t hash, bool* inserted) {
+    ht_migrate(table, MIGRATE_ENTRIES);
+    size_t empty;
+    ht_item* found = ht_find_item(table, key, length, hash, &empty);
+    *inserted = found == NULL;
+    if (found != NULL) {
+        return found;
     }
 
-    // If length will exceed half of current capacity, expand it.
-    if (table->length >= table->capacity / 2) {
+    // If length will exceed 7/8 of current capacity, expand it and find
+    // the empty slot again.
+    if (table->length + 1 > table->index.capacity / 8 * 7) {
         if (!ht_expand(table)) {
             return NULL;
         }
+        ht_find(table, &table->index, key, length, hash, &empty);
     }
 
-    // Set entry and update length.
-    return ht_set_item(table->entries, table->capacity, key, value,
-                        &table->length);
+    // The next entry starts a new block if it is the first of it.
+    size_t offset;
+    size_t k = entry_block(table->length, &offset);
+    if (table->blocks[k] == NULL) {
+        table->blocks[k] = malloc(((size_t)HT_FIRST_BLOCK << k) * sizeof(ht_item));
+        if (table->blocks[k] == NULL) {
+            return NULL;
+        }
+    }
+
+    // Didn't find key, copy it into the entry if it is short, or into
+    // the key blocks, then insert it.
+    ht_item* entry = &table->blocks[k][offset];
+    if (length <= HT_SMALL_KEY) {
+        memcpy(entry->small, key, length);
+        entry->small[length] = '\0';
+        entry->key = entry->small;
+    } else {
+        entry->key = ht_store_key(table, key, length);
+        if (entry->key == NULL) {
+            return NULL;
+        }
+    }
+    entry->value = NULL;
+    entry->hash = hash;
+    entry->length = length;
+    set_slot(&table->index, empty, table->length, hash);
+    table->length++;
+    return entry;
+}
+
+void** ht_upsert(kvphash_table* table, const char* key, size_t length,
+        uint64_t hash, bool* inserted) {
+    bool added;
+    ht_item* entry = ht_upsert_item(table, key, length, hash, &added);
+    if (inserted != NULL) {
+        *inserted = added;
+    }
+    return entry != NULL ? &entry->value : NULL;
+}
+
+const char* ht_set_hashed(kvphash_table* table, const char* key,
+        size_t length, uint64_t hash, void* value) {
+    assert(value != NULL);
+    if (value == NULL) {
+        return NULL;
+    }
+
+    bool inserted;
+    ht_item* entry = ht_upsert_item(table, key, length, hash, &inserted);
+    if (entry == NULL) {
+        return NULL;
+    }
+    entry->value = value;
+    return entry->key;
+}
+
+const char* ht_set_int(kvphash_table* table, const char* key, size_t length,
+        intptr_t value) {
+    bool inserted;
+    ht_item* entry = ht_upsert_item(table, key, length,
+        ht_hash(key, length), &inserted);
+    if (entry == NULL) {
+        return NULL;
+    }
+    entry->value = (void*)value;
+    return entry->key;
+}
+
+bool ht_get_int(kvphash_table* table, const char* key, size_t length,
+        intptr_t* value) {
+    ht_migrate(table, MIGRATE_ENTRIES);
+    size_t empty;
+    ht_item* entry = ht_find_item(table, key, length, ht_hash(key, length),
+        &empty);
+    if (entry == NULL) {
+        return false;
+    }
+    *value = (intptr_t)entry->value;
+    return true;
+}
+
+void ht_set_incremental(kvphash_table* table, bool incremental) {
+    table->incremental = incremental;
 }
 
 size_t ht_length(kvphash_table* table) {
@@ -200,18 +487,14 @@ hti ht_iterator(kvphash_table* table) {
 }
 
 bool ht_next(hti* it) {
-    // Loop till we've hit end of entries array.
+    // Entries are dense, in order of insertion.
     kvphash_table* table = it->_table;
-    while (it->_index < table->capacity) {
-        size_t i = it->_index;
-        it->_index++;
-        if (table->entries[i].key != NULL) {
-            // Found next non-empty item, update iterator key and value.
-            ht_item entry = table->entries[i];
-            it->key = entry.key;
-            it->value = entry.value;
-            return true;
-        }
+    if (it->_index >= table->length) {
+        return false;
     }
-    return false;
+    ht_item* entry = ht_entry(table, it->_index);
+    it->_index++;
+    it->key = entry->key;
+    it->value = entry->value;
+    return true;
 }
@@ -37,6 +37,7 @@ extern "C" {
 #include "utilits.h"
 
 #include <stddef.h>
+#include <stdint.h>
 
 // Hash table structure: create with ht_create, free with ht_destroy.
 typedef struct kvphash_table kvphash_table;
@@ -51,12 +52,63 @@ void ht_destroy(kvphash_table* table);
 // value (which was set with ht_set), or NULL if key not found.
 void* ht_get(kvphash_table* table, const char* key);
 
+// Get item with given key of length bytes (not NUL-terminated) from
+// hash table. Return value, or NULL if key not found.
+void* ht_get_n(kvphash_table* table, const char* key, size_t length);
+
+// Return hash of key of length bytes, the one used by the table (64-bit
+// FNV-1a); it may be computed once for ht_get_hashed and ht_set_hashed.
+uint64_t ht_hash(const char* key, size_t length);
+
+// Get item with given key of length bytes and its hash (see ht_hash).
+// Return value, or NULL if key not found.
+void* ht_get_hashed(kvphash_table* table, const char* key, size_t length,
+        uint64_t hash);
+
 // Set item with given key (NUL-terminated) to value (which must not
-// be NULL). If not already present in table, key is copied to newly
-// allocated memory (keys are freed automatically when ht_destroy is
-// called). Return address of copied key, or NULL if out of memory.
+// be NULL). If not already present in table, key is copied into its
+// entry if it is short (up to HT_SMALL_KEY bytes), otherwise into blocks
+// of keys owned by the table (keys are freed all at once when
+// ht_destroy is called). Return address of copied key, or NULL if out
+// of memory.
 const char* ht_set(kvphash_table* table, const char* key, void* value);
 
+// Set item with given key of length bytes (not NUL-terminated) and its
+// hash (see ht_hash) to value as ht_set does. Return address of the
+// copied key (NUL-terminated), or NULL if out of memory.
+const char* ht_set_hashed(kvphash_table* table, const char* key,
+        size_t length, uint64_t hash, void* value);
+
+// Find item with given key of length bytes and its hash (see ht_hash),
+// inserting it with NULL value (key is copied as by ht_set) if it is not
+// present, in one probe. Return address of the value to read or set,
+// or NULL if out of memory; *inserted (if not NULL) tells the item is
+// new. The value must be set to non-NULL, as ht_get returns NULL for
+// missing keys; entries do not move, the address is valid until
+// ht_destroy.
+void** ht_upsert(kvphash_table* table, const char* key, size_t length,
+        uint64_t hash, bool* inserted);
+
+// Set incremental resize mode: when the table grows, its entries are
+// added to the new slots by a bounded number on each following get or
+// set (both indexes are probed meanwhile) instead of all at once, so no
+// single call stalls on a large table. Off by default. While a resize
+// is pending, lookups (ht_get, ht_get_n, ht_get_hashed, ht_get_int) write
+// to the table too, so a table shared between threads must not be
+// incremental even if they only read it.
+void ht_set_incremental(kvphash_table* table, bool incremental);
+
+// Set item with given key of length bytes to integer value (which may
+// be 0) kept in the entry itself, as ht_set does. Return address of the
+// copied key, or NULL if out of memory.
+const char* ht_set_int(kvphash_table* table, const char* key, size_t length,
+        intptr_t value);
+
+// Get integer value of item with given key of length bytes (set by
+// ht_set_int) into *value. Return false if key not found.
+bool ht_get_int(kvphash_table* table, const char* key, size_t length,
+        intptr_t* value);
+
 // Return number of items in hash table.
 size_t ht_length(kvphash_table* table);
 
@@ -64,19 +116,56 @@ size_t ht_length(kvphash_table* table);
 
 ////////////////////////////////
 
-// Hash table entry (slot may be filled or empty).
+// Keys of up to this length are kept in the entry.
+#define HT_SMALL_KEY 15
+
+// Hash table entry. Entries are kept in insertion order in blocks which
+// never move, see ht_entry.
 typedef struct {
-    const char* key;  // key is NULL if this slot is empty
-    void* value;
+    const char* key;  // short key points to small
+    void* value;      // (or integer value set by ht_set_int)
+    uint64_t hash;    // hash of key (see ht_hash)
+    size_t length;    // length of key in bytes
+    char small[HT_SMALL_KEY + 1]; // short key with NUL
 } ht_item;
 
+// Control byte of an empty slot; a filled slot has 7-bit tag of its hash.
+#define HT_EMPTY 0x80
+// Slots whose control bytes are probed at once.
+#define HT_GROUP 16
+// Entries of the first block; block k has HT_FIRST_BLOCK << k entries.
+#define HT_FIRST_BLOCK 16
+// Number of entry blocks, enough for any size_t count.
+#define HT_BLOCKS 60
+
+// Slots of the hash index: control bytes and numbers of entries (of 1, 2,
+// 4 or 8 bytes as capacity needs).
+typedef struct {
+    uint8_t* control;   // control byte of each slot, then copy of the first
+                        // HT_GROUP ones to probe groups crossing the end
+    void* slots;        // entry number of each filled slot
+    size_t capacity;    // number of slots
+    unsigned width;     // bytes of entry number
+} ht_index;
+
 // Hash table structure: create with ht_create, free with ht_destroy.
 struct kvphash_table {
-    ht_item* entries;  // hash slots
-    size_t capacity;    // size of _entries array
+    ht_index index;     // hash slots
+    ht_item* blocks[HT_BLOCKS]; // entries in insertion order
     size_t length;      // number of items in hash table
+    struct ht_key_block* key_blocks; // texts of long keys, the last first
+
+    // Previous index while the table is resized incrementally: entries
+    // are added to the new index by a few on each call.
+    bool incremental;   // see ht_set_incremental
+    ht_index old;       // old.control is NULL unless resizing
+    size_t migrated;    // entries before it are in index
+    size_t migrate_end; // entries before it were in old index
 };
 
+// Return entry number i (less than ht_length) of table.
+ht_item* ht_entry(const kvphash_table* table, size_t i);
+
 
 // Hash table iterator: create with ht_iterator, iterate with ht_next.
 typedef struct {
@@ -85,7 +174,7 @@ typedef struct {
 
     // Don't use these fields directly.
     kvphash_table* _table;       // reference to hash table being iterated
-    size_t _index;    // current index into ht._entries
+    size_t _index;    // number of the next entry
 } hti;
 
 
@@ -94,9 +183,10 @@ typedef struct {
 // Return new hash table iterator (for use with ht_next).
 hti ht_iterator(kvphash_table* table);
 
-// Move iterator to next item in hash table, update iterator's key
-// and value to current item, and return true. If there are no more
-// items, return false. Don't call ht_set during iteration.
+// Move iterator to next item in hash table (in order of insertion),
+// update iterator's key and value to current item, and return true. If
+// there are no more items, return false. Items set during iteration are
+// iterated too.
 bool ht_next(hti* it);
 
 
@@ -0,0 +1,76 @@
+// Arena allocator demonstration program
+
+#include "kvp_arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main()
+{
+    const char* documents[] = {
+        "{\"a\" : \"1\",  \"b\" : 2,  \"c\": \"3\"}",
+        "{ \"a2\": true, \"b2\":\"false\"}",
+        "{\"escaped\": \"line\\nbreak \\u0416\", \"n\": -1.5e3}",
+    };
+    size_t count = sizeof(documents) / sizeof(*documents);
+
+    kvp_arena* arena = kvp_arena_create(4096);
+    if(arena == NULL) {
+        printf("arena was not created\n");
+        return -1;
+    }
+    kvp_allocator alloc = kvp_arena_allocator(arena);
+
+    // scratch of each document comes from the arena, released at once
+    for(int round = 0; round < 3; round++) {
+        for(size_t i = 0; i < count; i++) {
+            kvp_iterator json;
+            kvp_open_string(&json, documents[i]);
+            kvp_set_allocator(&json, &alloc);
+            enum kvp_json_type type;
+            while((type = kvp_next(&json)) != JSON_END) {
+                if(type == JSON_ERROR) {
+                    printf("document %zu: %s\n", i, kvp_get_error(&json));
+                    return -2;
+                }
+                if(round == 0)
+                    printf("%s ", kvp_get_string(&json, NULL));
+            }
+            kvp_close(&json);
+            kvp_arena_reset(arena);
+        }
+    }
+    printf("\nhigh-water mark: %zu bytes\n", kvp_arena_high_water(arena));
+
+    // the last allocation grows in place, earlier ones are copied
+    char* first = (char*)kvp_arena_alloc(arena, 10);
+    strcpy(first, "first");
+    char* grown = (char*)kvp_arena_realloc(arena, first, 100);
+    char* second = (char*)kvp_arena_alloc(arena, 10);
+    char* moved = (char*)kvp_arena_realloc(arena, grown, 200);
+    if(grown != first || moved == grown || second == NULL || strcmp(moved, "first") != 0) {
+        printf("arena realloc did not work\n");
+        return -3;
+    }
+
+    // big allocations take new blocks, after reset one block fits them
+    size_t held = 0;
+    for(int round = 0; round < 2; round++) {
+        for(int i = 0; i < 10; i++)
+            if(kvp_arena_alloc(arena, 3000) == NULL) {
+                printf("arena alloc did not work\n");
+                return -4;
+            }
+        kvp_arena_reset(arena);
+        if(round == 1 && arena->blocks_size != held) {
+            printf("arena reset did not work\n");
+            return -5;
+        }
+        held = arena->blocks_size;
+    }
+    printf("high-water mark: %zu bytes, block: %zu bytes\n", kvp_arena_high_water(arena), held);
+
+    kvp_arena_destroy(arena);
+    return 0;
+}
@@ -9,6 +9,7 @@
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 typedef struct {
     char* key;
@@ -34,14 +35,105 @@ int main() {
         }
     }
 
-    for (int i = 0; i < table->capacity; i++) {
-        if (table->entries[i].key != NULL) {
-            printf("index %d: key %s, value %d\n",
-                i, table->entries[i].key, *(int*)table->entries[i].value);
-        } else {
-            printf("index %d: empty\n", i);
+    // items are iterated in order of insertion
+    hti it = ht_iterator(table);
+    for (int i = 0; ht_next(&it); i++) {
+        if (i >= num_items || strcmp(it.key, items[i].key) != 0) {
+            printf("hash iteration is not in insertion order");
+            return -7;
         }
+        printf("item %d: key %s, value %d\n", i, it.key, *(int*)it.value);
     }
 
+    // keys taken from a text without NUL, each hashed and probed once
+    const char* text = "jane,new,foo,new";
+    static int added = 1;
+    for (const char* p = text; *p != '\0';) {
+        size_t length = strcspn(p, ",");
+        bool inserted;
+        void** value = ht_upsert(table, p, length, ht_hash(p, length), &inserted);
+        if (value == NULL) {
+            printf("hash upsert did not work");
+            return -3;
+        }
+        if (inserted) {
+            *value = &added;
+        }
+        printf("upsert %.*s: %s, value %d\n", (int)length, p,
+            inserted ? "inserted" : "found", *(int*)*value);
+        p += length + (p[length] == ',');
+    }
+    if (ht_length(table) != num_items + 1) {
+        printf("hash upsert inserted %zu keys", ht_length(table) - num_items);
+        return -4;
+    }
+
+    // integer values are kept in the slots, long keys in key blocks
+    const char* ids[] = {"id", "a key longer than fifteen bytes", "zero"};
+    for (int i = 0; i < 3; i++) {
+        if (ht_set_int(table, ids[i], strlen(ids[i]), 2 - i) == NULL) {
+            printf("hash set int did not work");
+            return -5;
+        }
+    }
+    for (int i = 0; i < 3; i++) {
+        intptr_t id;
+        if (!ht_get_int(table, ids[i], strlen(ids[i]), &id) || id != 2 - i) {
+            printf("hash get int did not work");
+            return -6;
+        }
+        printf("int %s: %d\n", ids[i], (int)id);
+    }
+
+    ht_destroy(table);
+
+    // incremental resize: the table grows several times while keys are
+    // inserted, each key is indexed once when migration finishes
+    table = ht_create();
+    if (table == NULL) {
+        printf("hash table was not created");
+        return -1;
+    }
+    ht_set_incremental(table, true);
+    const int num_keys = 20000;
+    char key[32];
+    for (int i = 0; i < num_keys; i++) {
+        snprintf(key, sizeof(key), i % 2 ? "k%d" : "incremental key %d", i);
+        if (ht_set_int(table, key, strlen(key), i) == NULL) {
+            printf("hash set int did not work");
+            return -5;
+        }
+    }
+    for (int i = 0; i < num_keys; i++) {
+        snprintf(key, sizeof(key), i % 2 ? "k%d" : "incremental key %d", i);
+        intptr_t value;
+        if (!ht_get_int(table, key, strlen(key), &value) || value != i) {
+            printf("incremental get of %s did not work", key);
+            return -8;
+        }
+    }
+    if (table->old.control != NULL) {
+        printf("incremental resize did not finish");
+        return -9;
+    }
+    size_t filled = 0;
+    for (size_t i = 0; i < table->index.capacity; i++) {
+        filled += table->index.control[i] != HT_EMPTY;
+    }
+    if (filled != ht_length(table)) {
+        printf("%zu slots filled for %zu keys", filled, ht_length(table));
+        return -10;
+    }
+    it = ht_iterator(table);
+    for (int i = 0; ht_next(&it); i++) {
+        if ((intptr_t)it.value != i) {
+            printf("incremental iteration is not in insertion order");
+            return -11;
+        }
+    }
+    printf("incremental: %zu keys in %zu slots\n", ht_length(table),
+        table->index.capacity);
+
+    ht_destroy(table);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,93 @@
+// Parallel newline delimited parsing demonstration program
+
+#include "kvp_parallel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DOCUMENTS 200000
+
+/* Counts pairs of each document into user array */
+static int count_pairs(kvp_iterator* json, size_t index, void* user)
+{
+    size_t* pairs = (size_t*)user;
+    enum kvp_json_type type;
+    while((type = kvp_next(json)) != JSON_END) {
+        if(type == JSON_ERROR)
+            return -1;
+        if(!json->isKey)
+            pairs[index]++;
+    }
+    return 0;
+}
+
+int main()
+{
+    size_t size = (size_t)DOCUMENTS * 64;
+    char* text = (char*)malloc(size);
+    size_t* pairs = (size_t*)calloc(DOCUMENTS, sizeof(size_t));
+    if(text == NULL || pairs == NULL) {
+        printf("out of memory\n");
+        return -1;
+    }
+
+    // document i has i % 3 + 1 pairs, every 1000th line is blank
+    size_t length = 0;
+    size_t lines = 0;
+    for(size_t i = 0; i < DOCUMENTS; i++) {
+        if(i % 1000 == 999) {
+            text[length++] = '\n';
+            lines++;
+        }
+        length += sprintf(text + length, "{\"id\": %zu", i);
+        for(size_t k = 0; k < i % 3; k++)
+            length += sprintf(text + length, ", \"k%zu\": \"v\"", k);
+        length += sprintf(text + length, "}\n");
+        lines++;
+    }
+
+    kvp_iterator json;
+    kvp_open_buffer(&json, text, length);
+    if(kvp_parallel_for_each_document(&json, 4, count_pairs, pairs, NULL) != 0) {
+        printf("parallel parsing failed: %s\n", kvp_get_error(&json));
+        return -2;
+    }
+    for(size_t i = 0; i < DOCUMENTS; i++) {
+        if(pairs[i] != i % 3 + 1) {
+            printf("document %zu has %zu pairs\n", i, pairs[i]);
+            return -3;
+        }
+    }
+    printf("%d documents, %zu lines parsed\n", DOCUMENTS, kvp_get_lineno(&json));
+    kvp_close(&json);
+
+    // the first of broken documents is reported with its line
+    char* bad = strstr(text, "{\"id\": 150001,");
+    bad[1] = '?';
+    text[length / 3] = '?';
+    size_t expect_document = 0;
+    size_t expect_line = 0;
+    for(size_t i = 0; i < length / 3; i++) {
+        if(text[i] == '\n') {
+            expect_line++;
+            expect_document += i > 0 && text[i - 1] != '\n';
+        }
+    }
+    size_t document = 0;
+    kvp_open_buffer(&json, text, length);
+    if(kvp_parallel_for_each_document(&json, 4, count_pairs, pairs, &document) == 0) {
+        printf("error was not found\n");
+        return -4;
+    }
+    printf("error in document %zu at line %zu: %s\n", document, kvp_get_lineno(&json), kvp_get_error(&json));
+    if(document != expect_document || kvp_get_lineno(&json) != expect_line) {
+        printf("expected error in document %zu at line %zu\n", expect_document, expect_line);
+        return -5;
+    }
+    kvp_close(&json);
+
+    free(pairs);
+    free(text);
+    return 0;
+}
@@ -1,4 +1,6 @@
 #include "kvp_parser.h"
+#include "kvp_simd.h"
+#include "kvphash_table.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -187,4 +189,161 @@ int main()
             "first test", json_typename[expect], expect_str, json_typename[actual], actual_str);
     }
     kvp_close(&json);
+
+    // tape of the same text gives the same values
+    kvp_tape tape;
+    kvp_tape_init(&tape);
+    kvp_open_string(&json, str);
+    success = kvp_parse_tape(&json, &tape) == 0;
+    for(size_t i = 0; success && i < seqlen; i++) {
+        const char* text;
+        size_t length;
+        expect = seq[i].type;
+        actual = kvp_tape_get(&tape, i, &text, &length);
+        expect_str = seq[i].str ? seq[i].str : "";
+        actual_str = has_value(actual) ? text : "";
+        if(actual != expect || (seq[i].str && (length != strlen(expect_str) || strncmp(expect_str, text, length))))
+            success = 0;
+    }
+    if(success) {
+        printf(C_GREEN("PASS") " %s\n", "tape test");
+    } else {
+        printf(C_RED("FAIL") " %s: %s\n", "tape test", kvp_get_error(&json));
+    }
+    kvp_tape_close(&tape);
+    kvp_close(&json);
+
+    // tape reports the error of a bad escape as kvp_next does
+    static const char bad_escape[] = "{\"x\": \"a\\qb\"}";
+    char next_error[256];
+    kvp_open_string(&json, bad_escape);
+    while((actual = kvp_next(&json)) != JSON_ERROR && actual != JSON_END)
+        ;
+    snprintf(next_error, sizeof(next_error), "%s", kvp_get_error(&json));
+    kvp_close(&json);
+    kvp_tape_init(&tape);
+    kvp_open_string(&json, bad_escape);
+    success = actual == JSON_ERROR && kvp_parse_tape(&json, &tape) != 0 && strcmp(next_error, kvp_get_error(&json)) == 0;
+    if(success) {
+        printf(C_GREEN("PASS") " %s\n", "tape error test");
+    } else {
+        printf(C_RED("FAIL") " %s: %s / %s\n", "tape error test", next_error, kvp_get_error(&json));
+    }
+    kvp_tape_close(&tape);
+    kvp_close(&json);
+
+    // pairs read in batch carry key, value and parsed number
+    kvp_pair pairs[4];
+    kvp_open_string(&json, str);
+    size_t n = kvp_next_batch(&json, pairs, countof(pairs));
+    success = n == 1 && kvp_get_type(&json) == JSON_END && pairs[0].type == JSON_NUMBER &&
+        pairs[0].key_length == 1 && pairs[0].key[0] == 'x' && pairs[0].integer && pairs[0].scalar.integer == 123;
+    if(success) {
+        printf(C_GREEN("PASS") " %s\n", "batch test");
+    } else {
+        printf(C_RED("FAIL") " %s: %zu pairs %s\n", "batch test", n, kvp_get_error(&json));
+    }
+    kvp_close(&json);
+
+    // text pushed byte by byte gives the pair once it is complete
+    kvp_open_feed(&json);
+    n = 0;
+    for(size_t i = 0; i <= sizeof(str) - 1; i++) {
+        kvp_feed(&json, str + i, i < sizeof(str) - 1 ? 1 : 0);
+        while((actual = kvp_next_pair(&json, &pairs[0])) == JSON_NUMBER)
+            n += pairs[0].scalar.integer == 123 && pairs[0].key[0] == 'x';
+        if(actual == JSON_ERROR)
+            break;
+    }
+    if(n == 1 && actual == JSON_END) {
+        printf(C_GREEN("PASS") " %s\n", "feed test");
+    } else {
+        printf(C_RED("FAIL") " %s: %s\n", "feed test", kvp_get_error(&json));
+    }
+    kvp_close(&json);
+
+    // next chunk is refused while pairs of the previous one are unread
+    kvp_open_feed(&json);
+    success = kvp_feed(&json, "{\"a\": 1, \"b\": 2, ", 17) == 0 && kvp_next_pair(&json, &pairs[0]) == JSON_NUMBER &&
+        kvp_feed(&json, "\"c\": 3}", 7) != 0 && strcmp(kvp_get_error(&json), "previous chunk is not read") == 0;
+    if(success) {
+        printf(C_GREEN("PASS") " %s\n", "feed order test");
+    } else {
+        printf(C_RED("FAIL") " %s: %s\n", "feed order test", kvp_get_error(&json));
+    }
+    kvp_close(&json);
+
+    // interned keys get the same id in every object, keys of the known
+    // shape are predicted
+    static const char objects[] = "{\"a\": 1, \"b\": 2}\n{\"b\": 3, \"a\": 4}\n{\"a\": 5, \"b\": 6}";
+    static const size_t ids[] = {1, 2, 2, 1, 1, 2};
+    size_t hits, misses;
+    kvphash_table* keys = ht_create();
+    kvp_open_string(&json, objects);
+    kvp_set_key_interning(&json, keys);
+    n = 0;
+    while(kvp_next_pair(&json, &pairs[0]) == JSON_NUMBER && n < countof(ids) && pairs[0].key_id == ids[n])
+        n++;
+    kvp_get_shape_stats(&json, &hits, &misses);
+    if(n == countof(ids) && kvp_get_type(&json) == JSON_END && ht_length(keys) == 2 && hits == 2 && misses == 4) {
+        printf(C_GREEN("PASS") " %s\n", "intern test");
+    } else {
+        printf(C_RED("FAIL") " %s: %zu keys %s\n", "intern test", n, kvp_get_error(&json));
+    }
+    kvp_close(&json);
+    ht_destroy(keys);
+
+    // object cut by the end of text is an error
+    kvp_open_string(&json, "{\"x\": 1");
+    n = 0;
+    while((actual = kvp_next(&json)) == JSON_STRING || actual == JSON_NUMBER)
+        n++;
+    if(n == 2 && actual == JSON_ERROR) {
+        printf(C_GREEN("PASS") " %s\n", "end test");
+    } else {
+        printf(C_RED("FAIL") " %s: %zu tokens %s\n", "end test", n, kvp_get_error(&json));
+    }
+    kvp_close(&json);
+
+#ifdef KVP_STATS
+    // counters of a known document: 7 keys, escapes \n and \u00e9, 12 two
+    // byte sequences (in runs shorter and longer than a SIMD block), every
+    // value type; pushed byte by byte the same counts come out
+    static const char counted[] = "{\"s\": \"a\\nb\\u00e9\", \"u\": \"\xd0\xbf\xd1\x80\xd0\xb8\xd0\xb2\xd0\xb5\xd1\x82 "
+        "\xd0\xbc\xd0\xb8\xd1\x80, \xc3\xa9t\xc3\xa9\", \"d\": \"\xc3\xa9\", \"n\": 12, \"t\": true, \"f\": false, \"z\": null}";
+    static const size_t counted_tokens[JSON_END + 1] = {[JSON_STRING] = 10, [JSON_NUMBER] = 1, [JSON_TRUE] = 1,
+        [JSON_FALSE] = 1, [JSON_NULL] = 1};
+    kvp_stats stats[2];
+    kvp_open_string(&json, counted);
+    while((actual = kvp_next_pair(&json, &pairs[0])) != JSON_END && actual != JSON_ERROR)
+        ;
+    success = actual == JSON_END && kvp_get_stats(&json, &stats[0]);
+    kvp_close(&json);
+    kvp_open_feed(&json);
+    for(size_t i = 0; success && i <= sizeof(counted) - 1; i++) {
+        kvp_feed(&json, counted + i, i < sizeof(counted) - 1 ? 1 : 0);
+        while((actual = kvp_next_pair(&json, &pairs[0])) != JSON_END && actual != JSON_ERROR)
+            ;
+        success = actual == JSON_END;
+    }
+    success = success && kvp_get_stats(&json, &stats[1]);
+    for(int k = 0; success && k < 2; k++) {
+        success = stats[k].bytes == sizeof(counted) - 1 && stats[k].keys == 7 && stats[k].escapes == 2 &&
+            stats[k].utf8 == 12 && memcmp(stats[k].tokens, counted_tokens, sizeof(counted_tokens)) == 0;
+    }
+    // lead bytes are counted alike in SIMD blocks and in the tail
+    for(size_t i = 0; success && i < sizeof(counted) - 1; i++) {
+        size_t leads = 0;
+        for(size_t k = i; k < sizeof(counted) - 1; k++)
+            leads += (unsigned char)counted[k] >= 0xC0;
+        success = kvp_count_utf8_leads(counted + i, sizeof(counted) - 1 - i) == leads;
+    }
+    if(success) {
+        printf(C_GREEN("PASS") " %s\n", "stats test");
+    } else {
+        printf(C_RED("FAIL") " %s: %zu bytes, %zu keys, %zu escapes, %zu utf8 %s\n", "stats test", stats[0].bytes,
+            stats[0].keys, stats[0].escapes, stats[0].utf8, kvp_get_error(&json));
+    }
+    kvp_close(&json);
+#endif
 }
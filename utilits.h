@@ -162,16 +162,45 @@ static int is_legal_utf8(const unsigned char* bytes, int length)
     return *bytes <= 0xF4;
 }
 
+// value of hex digit by byte, -1 for other bytes
+static const signed char hex_digit_value[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
 static int getxdigit(int c)
 {
-    if(!isxdigit(c)) {
+    if(c < 0 || c > 0xFF) {
+        return -1;
+    }
+    return hex_digit_value[c];
+}
+
+// value of 4 hex digits at p (as in \uXXXX), -1 if some is not a hex digit
+static inline long getxdigits4(const char* p)
+{
+    int a = hex_digit_value[(unsigned char)p[0]];
+    int b = hex_digit_value[(unsigned char)p[1]];
+    int c = hex_digit_value[(unsigned char)p[2]];
+    int d = hex_digit_value[(unsigned char)p[3]];
+    if((a | b | c | d) < 0) {
         return -1;
     }
-    int d;
-    char buf[4];
-    snprintf(buf, 4, "0x%c", (char)c);
-    sscanf(buf, "%x", &d);
-    return d;
+    return ((long)a << 12) | (b << 8) | (c << 4) | d;
 }
 
 #ifdef __cplusplus